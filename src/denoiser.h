@@ -0,0 +1,289 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "math_utils.h"
+
+// Edge-aware a-trous wavelet denoiser guided by normal, albedo and variance
+// buffers, after SVGF (Schied et al. 2017, "Spatiotemporal Variance-Guided
+// Filtering"), without the temporal part.
+//
+// Each pass is a 5x5 B3-spline blur whose taps are spread 2^i pixels apart,
+// so a few passes cover a wide footprint at a fixed cost per pixel. Taps are
+// down-weighted when their normal or albedo differ from the center pixel,
+// which keeps geometric and texture edges sharp, and when their luminance
+// differs by more than the local noise level. Tying the color term to the
+// per-pixel standard deviation is what lets real lighting gradients (shadow
+// edges, falloff) through while noise of the same size is smoothed out. The
+// variance is filtered along with the color, so later passes, which see a
+// smoother image, become more conservative on their own.
+//
+// The filter runs on demodulated irradiance (color / albedo) so that surface
+// color does not get blurred across, then multiplies the albedo back in.
+//
+// It does not reach the quality of 4x the samples. Against 256 spp
+// references of the box and lights scenes at 480x270, one pass gains about
+// 3.0 / 1.5 dB at 1 spp, 2.1 / 0.5 dB at 4 spp and 1.6 / 0.1 dB at 9 spp,
+// where 4x the samples gains 5-9 dB. Most of the remaining error is at
+// geometric and hard shadow edges, which are left (nearly) alone. From 16
+// spp on it loses PSNR at the lights scene's hard shadows, so
+// iterationsFor() switches it off there.
+class Denoiser {
+public:
+    Denoiser(int width, int height, int iterations = 1,
+             float sigmaLuminance = 4.0f, float normalPower = 128.0f,
+             float sigmaAlbedo = 0.1f)
+        : width(width),
+          height(height),
+          iterations(iterations),
+          sigmaLuminance(sigmaLuminance),
+          normalPower(normalPower),
+          sigmaAlbedo(sigmaAlbedo) {}
+
+    // Passes worth running on a render with samplesPerPixel samples per
+    // pixel: more passes and more samples both lose more detail than they
+    // remove noise, so one pass, and none above MAX_SAMPLES_PER_PIXEL
+    static int iterationsFor(int samplesPerPixel) {
+        return samplesPerPixel <= MAX_SAMPLES_PER_PIXEL ? 1 : 0;
+    }
+
+    // Filters color in place. All buffers are row-major, width * height.
+    // variance holds the variance of each pixel's mean luminance; if it is
+    // empty, for example with one sample per pixel, it is estimated from
+    // each pixel's 3x3 neighbourhood instead.
+    void denoise(std::vector<Vec3>& color, const std::vector<Vec3>& normal,
+                 const std::vector<Vec3>& albedo,
+                 const std::vector<float>& variance) const {
+        size_t count = static_cast<size_t>(width) * height;
+        if (color.size() != count || normal.size() != count ||
+            albedo.size() != count ||
+            (!variance.empty() && variance.size() != count))
+            return;
+
+        // Demodulate: divide out albedo, leaving only lighting to filter.
+        // The variance scales with the square of the same factor.
+        std::vector<Vec3> src(count);
+        std::vector<float> srcVariance(count);
+        for (size_t i = 0; i < count; i++) {
+            Vec3 a = safeAlbedo(albedo[i]);
+            src[i] = color[i] / a;
+            if (!variance.empty()) {
+                float scale = luminance(a);
+                srcVariance[i] = variance[i] / (scale * scale);
+            }
+        }
+        if (variance.empty()) spatialVariance(src, srcVariance);
+        const std::vector<Vec3> noisy = src;
+        const std::vector<float> noisyVariance = srcVariance;
+
+        // Normals are averaged over the pixel's samples; only their
+        // direction is compared. A short average normal means the samples
+        // hit surfaces facing different ways, i.e. the pixel straddles a
+        // geometric edge. Its variance is then coverage, not noise, and
+        // filtering it would smear the antialiased edge. Such pixels get a
+        // zero normal, which the filter treats like a miss: they are left
+        // as they are and never used as taps. The renderer zeroes the
+        // normal of pixels whose samples hit different albedos likewise.
+        std::vector<Vec3> unitNormal(count);
+        for (size_t i = 0; i < count; i++) {
+            float length = normal[i].length();
+            unitNormal[i] = length > EDGE_NORMAL_LENGTH ? normal[i] / length
+                                                        : Vec3(0, 0, 0);
+        }
+
+        std::vector<Vec3> dst(count);
+        std::vector<float> dstVariance(count);
+        for (int i = 0; i < iterations; i++) {
+            int step = 1 << i;
+            runTiles([&](int x0, int y0, int x1, int y1) {
+                filterTile(src, srcVariance, dst, dstVariance, unitNormal,
+                           albedo, step, x0, y0, x1, y1);
+            });
+            std::swap(src, dst);
+            std::swap(srcVariance, dstVariance);
+        }
+
+        // Keep each pixel within MAX_SHIFT standard deviations of its raw
+        // mean. Across a hard shadow edge the samples' variance is coverage,
+        // like at geometric edges, and stratified samples estimate such a
+        // pixel far better than its variance suggests; unclamped, the
+        // filter adds more bias there than it removes noise.
+        for (size_t i = 0; i < count; i++) {
+            float limit = MAX_SHIFT * std::sqrt(noisyVariance[i]);
+            float shift = std::fabs(luminance(src[i]) - luminance(noisy[i]));
+            if (shift > limit)
+                src[i] = noisy[i] + (src[i] - noisy[i]) * (limit / shift);
+        }
+
+        // Remodulate
+        for (size_t i = 0; i < count; i++) {
+            color[i] = src[i] * safeAlbedo(albedo[i]);
+        }
+    }
+
+private:
+    static constexpr int TILE_SIZE = 32;
+    static constexpr float EDGE_NORMAL_LENGTH = 0.95f;
+    static constexpr float MAX_SHIFT = 1.0f;
+    static constexpr int MAX_SAMPLES_PER_PIXEL = 9;
+
+    static Vec3 safeAlbedo(const Vec3& a) {
+        // Misses have zero albedo; leave their color untouched
+        const float eps = 1e-3f;
+        return Vec3(a.x > eps ? a.x : 1.0f, a.y > eps ? a.y : 1.0f,
+                    a.z > eps ? a.z : 1.0f);
+    }
+
+    // Luminance variance over each pixel's 3x3 neighbourhood
+    void spatialVariance(const std::vector<Vec3>& src,
+                         std::vector<float>& variance) const {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                float sum = 0.0f, sumSquares = 0.0f;
+                int n = 0;
+                int j0 = std::max(0, y - 1), j1 = std::min(height - 1, y + 1);
+                int i0 = std::max(0, x - 1), i1 = std::min(width - 1, x + 1);
+                for (int j = j0; j <= j1; j++) {
+                    for (int i = i0; i <= i1; i++) {
+                        float l = luminance(src[j * width + i]);
+                        sum += l;
+                        sumSquares += l * l;
+                        n++;
+                    }
+                }
+                float mean = sum / n;
+                variance[y * width + x] =
+                    std::max(0.0f, sumSquares / n - mean * mean);
+            }
+        }
+    }
+
+    // Splits the image into TILE_SIZE x TILE_SIZE blocks and hands them out to
+    // worker threads. A tile plus its 5x5 stencil stays resident in cache
+    // while it is being filtered.
+    template <typename Func>
+    void runTiles(const Func& func) const {
+        int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        int tileCount = tilesX * tilesY;
+
+        std::atomic<int> nextTile(0);
+        auto worker = [&]() {
+            for (int t = nextTile++; t < tileCount; t = nextTile++) {
+                int x0 = (t % tilesX) * TILE_SIZE;
+                int y0 = (t / tilesX) * TILE_SIZE;
+                func(x0, y0, std::min(x0 + TILE_SIZE, width),
+                     std::min(y0 + TILE_SIZE, height));
+            }
+        };
+
+        int threadCount = static_cast<int>(std::thread::hardware_concurrency());
+        threadCount = std::max(1, std::min(threadCount, tileCount));
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < threadCount; i++) threads.emplace_back(worker);
+        worker();
+        for (auto& thread : threads) thread.join();
+    }
+
+    // Variance at p, blurred over its 3x3 neighbourhood so that single noisy
+    // estimates do not switch the color term on and off. Edge pixels and
+    // misses are skipped: the coverage variance of an edge pixel would
+    // otherwise switch off the color term of its neighbours and let them
+    // blur along the steep gradients found next to edges.
+    float blurredVariance(const std::vector<float>& variance,
+                          const std::vector<Vec3>& normal, int x,
+                          int y) const {
+        static const float kernel[2] = {1.0f / 4.0f, 1.0f / 8.0f};
+        float sum = 0.0f, weightSum = 0.0f;
+        for (int j = -1; j <= 1; j++) {
+            int qy = y + j;
+            if (qy < 0 || qy >= height) continue;
+            for (int i = -1; i <= 1; i++) {
+                int qx = x + i;
+                if (qx < 0 || qx >= width) continue;
+                int q = qy * width + qx;
+                if (normal[q].lengthSquared() == 0.0f) continue;
+                float w = kernel[std::abs(i)] * kernel[std::abs(j)];
+                sum += variance[q] * w;
+                weightSum += w;
+            }
+        }
+        return weightSum > 0.0f ? sum / weightSum : 0.0f;
+    }
+
+    void filterTile(const std::vector<Vec3>& src,
+                    const std::vector<float>& srcVariance,
+                    std::vector<Vec3>& dst, std::vector<float>& dstVariance,
+                    const std::vector<Vec3>& normal,
+                    const std::vector<Vec3>& albedo, int step, int x0, int y0,
+                    int x1, int y1) const {
+        static const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f,
+                                        3.0f / 8.0f, 1.0f / 4.0f,
+                                        1.0f / 16.0f};
+
+        float invAlbedo = 1.0f / (sigmaAlbedo * sigmaAlbedo);
+
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                int p = y * width + x;
+                float lumP = luminance(src[p]);
+                const Vec3& nP = normal[p];
+                const Vec3& aP = albedo[p];
+
+                // Luminance differences are measured in standard deviations
+                float stdDev =
+                    std::sqrt(blurredVariance(srcVariance, normal, x, y));
+                float invLum = 1.0f / (sigmaLuminance * stdDev + 1e-6f);
+
+                Vec3 sum(0, 0, 0);
+                float weightSum = 0.0f;
+                float varianceSum = 0.0f;
+                for (int j = -2; j <= 2; j++) {
+                    int qy = y + j * step;
+                    if (qy < 0 || qy >= height) continue;
+                    for (int i = -2; i <= 2; i++) {
+                        int qx = x + i * step;
+                        if (qx < 0 || qx >= width) continue;
+                        int q = qy * width + qx;
+
+                        float dLum = std::fabs(luminance(src[q]) - lumP);
+                        float dAlbedo = (albedo[q] - aP).lengthSquared();
+                        float wNormal = std::pow(
+                            std::max(0.0f, normal[q].dot(nP)), normalPower);
+                        float w = kernel[i + 2] * kernel[j + 2] * wNormal *
+                                  std::exp(-dLum * invLum -
+                                           dAlbedo * invAlbedo);
+
+                        sum += src[q] * w;
+                        weightSum += w;
+                        varianceSum += w * w * srcVariance[q];
+                    }
+                }
+
+                // Misses and edge pixels have a zero normal and so reject
+                // every tap, including their own; leave them as they are
+                if (weightSum > 0.0f) {
+                    dst[p] = sum / weightSum;
+                    dstVariance[p] = varianceSum / (weightSum * weightSum);
+                } else {
+                    dst[p] = src[p];
+                    dstVariance[p] = srcVariance[p];
+                }
+            }
+        }
+    }
+
+    int width, height;
+    int iterations;
+    float sigmaLuminance;  // Luminance tolerance, in standard deviations
+    float normalPower;     // Exponent on the normals' dot product
+    float sigmaAlbedo;
+};
+
+#endif  // DENOISER_H
@@ -0,0 +1,69 @@
+#ifndef IMAGE_COMPARE_H
+#define IMAGE_COMPARE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#include "ppmwriter.h"
+
+struct ImageDiff {
+    bool sizeMatches = false;
+    int maxError = 0;              // Largest per-channel difference
+    size_t mismatchedPixels = 0;   // Pixels with a channel over tolerance
+    double psnr = 0.0;             // In dB, infinite for identical images
+};
+
+// Compares a render against a reference image. A pixel mismatches when any
+// channel differs by more than tolerance. If diff is given it receives a
+// visualisation: mismatched pixels in red, the rest as the amplified
+// difference so small drift is still visible.
+ImageDiff compareImages(const PPMWriter& image, const PPMWriter& reference,
+                        int tolerance, PPMWriter* diff = nullptr) {
+    ImageDiff result;
+    int width = image.getWidth();
+    int height = image.getHeight();
+    if (width != reference.getWidth() || height != reference.getHeight())
+        return result;
+    result.sizeMatches = true;
+
+    if (diff) *diff = PPMWriter(width, height);
+
+    double squaredError = 0.0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char a[3], b[3];
+            image.getPixel(x, y, a[0], a[1], a[2]);
+            reference.getPixel(x, y, b[0], b[1], b[2]);
+
+            int err[3];
+            int pixelMax = 0;
+            for (int c = 0; c < 3; c++) {
+                err[c] = std::abs(int(a[c]) - int(b[c]));
+                pixelMax = std::max(pixelMax, err[c]);
+                squaredError += double(err[c]) * err[c];
+            }
+            result.maxError = std::max(result.maxError, pixelMax);
+
+            bool mismatch = pixelMax > tolerance;
+            if (mismatch) result.mismatchedPixels++;
+
+            if (diff) {
+                if (mismatch) {
+                    diff->setPixel(x, y, 255, 0, 0);
+                } else {
+                    diff->setPixel(x, y, err[0] * 16, err[1] * 16,
+                                   err[2] * 16);
+                }
+            }
+        }
+    }
+
+    double mse = squaredError / (double(width) * height * 3);
+    result.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse)
+                            : std::numeric_limits<double>::infinity();
+    return result;
+}
+
+#endif  // IMAGE_COMPARE_H
@@ -1,6 +1,8 @@
 #ifndef LIGHT_H
 #define LIGHT_H
 
+#include <limits>
+
 #include "math_utils.h"
 
 struct PointLight {
@@ -17,18 +19,327 @@ struct DirectionalLight {
         : direction(direction), color(color) {}
 };
 
+struct SpotLight {
+    Vec3 position;
+    Vec3 direction;
+    Vec3 color;
+    float cosInner;  // Full intensity inside this cone
+    float cosOuter;  // No light outside this cone
+
+    // Angles are half-angles of the cone, in radians
+    SpotLight(const Vec3& position, const Vec3& direction, const Vec3& color,
+              float innerAngle, float outerAngle)
+        : position(position),
+          direction(direction.normalized()),
+          color(color),
+          cosInner(std::cos(innerAngle)),
+          cosOuter(std::cos(outerAngle)) {}
+};
+
+// One-sided parallelogram emitter spanned by two edges from a corner. It
+// emits towards edgeU x edgeV.
+struct RectLight {
+    Vec3 corner;
+    Vec3 edgeU;
+    Vec3 edgeV;
+    Vec3 color;  // Emitted radiance
+    RectLight(const Vec3& corner, const Vec3& edgeU, const Vec3& edgeV,
+              const Vec3& color)
+        : corner(corner), edgeU(edgeU), edgeV(edgeV), color(color) {}
+};
+
+struct SphereLight {
+    Vec3 center;
+    float radius;
+    Vec3 color;  // Emitted radiance
+    SphereLight(const Vec3& center, float radius, const Vec3& color)
+        : center(center), radius(radius), color(color) {}
+};
+
 struct Light {
-    enum LightType { POINT, DIRECTIONAL, SPOT };
+    enum LightType { POINT, DIRECTIONAL, SPOT, RECT, SPHERE };
 
     Light(const LightType& type, const PointLight& point_light)
         : type(type), pointLight(point_light) {}
     Light(const LightType& type, const DirectionalLight& directional_light)
         : type(type), directionalLight(directional_light) {}
+    Light(const LightType& type, const SpotLight& spot_light)
+        : type(type), spotLight(spot_light) {}
+    Light(const LightType& type, const RectLight& rect_light)
+        : type(type), rectLight(rect_light) {}
+    Light(const LightType& type, const SphereLight& sphere_light)
+        : type(type), sphereLight(sphere_light) {}
     LightType type;
     union {
         PointLight pointLight;
         DirectionalLight directionalLight;
+        SpotLight spotLight;
+        RectLight rectLight;
+        SphereLight sphereLight;
     };
+
+    // Area lights need several samples for soft shadows, the rest are
+    // delta lights and a single sample is exact.
+    bool isArea() const {
+        return type == LightType::RECT || type == LightType::SPHERE;
+    }
+};
+
+// A single direction towards a light, as seen from a shading point
+struct LightSample {
+    Vec3 direction;  // Unit vector from the shading point towards the light
+    float distance;  // Distance to the sampled point, for shadow rays
+    Vec3 intensity;  // Incoming light divided by the sample pdf
+};
+
+inline LightSample samplePointLight(const PointLight& light, const Vec3& p) {
+    LightSample s;
+    Vec3 to_light = light.position - p;
+    s.distance = to_light.length();
+    s.direction = to_light / s.distance;
+    s.intensity = light.color;
+    return s;
+}
+
+inline LightSample sampleDirectionalLight(const DirectionalLight& light) {
+    LightSample s;
+    s.direction = -light.direction.normalized();
+    s.distance = std::numeric_limits<float>::max();
+    s.intensity = light.color;
+    return s;
+}
+
+inline LightSample sampleSpotLight(const SpotLight& light, const Vec3& p) {
+    LightSample s;
+    Vec3 to_light = light.position - p;
+    s.distance = to_light.length();
+    s.direction = to_light / s.distance;
+
+    // Smoothstep between the outer and inner cone
+    float cos_angle = -s.direction.dot(light.direction);
+    float range = std::max(light.cosInner - light.cosOuter, 1e-4f);
+    float t = clamp((cos_angle - light.cosOuter) / range, 0.0f, 1.0f);
+    s.intensity = light.color * (t * t * (3.0f - 2.0f * t));
+    return s;
+}
+
+// Picks the point corner + u1 * edgeU + u2 * edgeV, i.e. uniform over the
+// area. The pdf in solid angle is r^2 / (A * cos(theta_light)).
+inline LightSample sampleRectLightArea(const RectLight& light, const Vec3& p,
+                                       float u1, float u2) {
+    LightSample s;
+    Vec3 cross = light.edgeU.cross(light.edgeV);
+    float area = cross.length();
+    Vec3 light_normal = cross / area;
+
+    Vec3 to_light = light.corner + light.edgeU * u1 + light.edgeV * u2 - p;
+    float dist2 = to_light.lengthSquared();
+    s.distance = std::sqrt(dist2);
+    s.direction = to_light / s.distance;
+
+    float cos_light = -s.direction.dot(light_normal);
+    s.intensity = cos_light > 0.0f
+                      ? light.color * (cos_light * area / dist2)
+                      : Vec3(0, 0, 0);
+    return s;
+}
+
+// Per shading point setup for sampling the solid angle subtended by a
+// rectangle uniformly (Urena et al. 2013, "An Area-Preserving
+// Parametrization for Spherical Rectangles"). Unlike area sampling, every
+// sample carries the same weight no matter how close or large the panel is,
+// which removes the 1 / r^2 and cosine terms that make nearby panels noisy.
+// The pdf is 1 / solid angle.
+struct SphericalRect {
+    enum Mode { SOLID_ANGLE, AREA, BEHIND };
+    Mode mode;
+
+    // Local frame at p with z along the emitter normal. The panel spans
+    // [x0, x1] x [y0, y1] at height z0, which is negative when p is in front
+    // of the emitter, the orientation the parametrization expects.
+    Vec3 x, y, z;
+    float x0, x1, y0, y1, z0;
+    float b0, b1, k, solidAngle;
+};
+
+// Below this solid angle the panel is small enough that area sampling is
+// already close to ideal, and the solid angle, a small difference of angles
+// near pi / 2, starts losing float precision
+#define SPHERICAL_RECT_MIN_SOLID_ANGLE 1e-2f
+
+// The parametrization needs perpendicular edges; parallelograms and small
+// panels fall back to area sampling.
+inline SphericalRect setupSphericalRect(const RectLight& light,
+                                        const Vec3& p) {
+    SphericalRect r;
+    r.mode = SphericalRect::AREA;
+
+    float ex_len = light.edgeU.length();
+    float ey_len = light.edgeV.length();
+    r.x = light.edgeU / ex_len;
+    r.y = light.edgeV / ey_len;
+    if (std::fabs(r.x.dot(r.y)) > 1e-4f) return r;
+
+    r.z = r.x.cross(r.y);
+    Vec3 d = light.corner - p;
+    r.z0 = d.dot(r.z);
+    if (r.z0 >= 0.0f) {
+        // p is behind the one-sided emitter, or in its plane
+        r.mode = SphericalRect::BEHIND;
+        return r;
+    }
+
+    r.x0 = d.dot(r.x);
+    r.x1 = r.x0 + ex_len;
+    r.y0 = d.dot(r.y);
+    r.y1 = r.y0 + ey_len;
+
+    // Normals of the planes through p and each edge of the rectangle
+    Vec3 n0 = Vec3(0, r.z0, -r.y0).normalized();
+    Vec3 n1 = Vec3(-r.z0, 0, r.x1).normalized();
+    Vec3 n2 = Vec3(0, -r.z0, r.y1).normalized();
+    Vec3 n3 = Vec3(r.z0, 0, -r.x0).normalized();
+
+    // Interior angles of the spherical rectangle
+    float g0 = std::acos(clamp(-n0.dot(n1), -1.0f, 1.0f));
+    float g1 = std::acos(clamp(-n1.dot(n2), -1.0f, 1.0f));
+    float g2 = std::acos(clamp(-n2.dot(n3), -1.0f, 1.0f));
+    float g3 = std::acos(clamp(-n3.dot(n0), -1.0f, 1.0f));
+    r.b0 = n0.z;
+    r.b1 = n2.z;
+    r.k = 2.0f * PI - g2 - g3;
+    r.solidAngle = g0 + g1 - r.k;
+    if (r.solidAngle >= SPHERICAL_RECT_MIN_SOLID_ANGLE)
+        r.mode = SphericalRect::SOLID_ANGLE;
+    return r;
+}
+
+inline LightSample sampleSphericalRect(const SphericalRect& r,
+                                       const RectLight& light, const Vec3& p,
+                                       float u1, float u2) {
+    if (r.mode == SphericalRect::AREA) {
+        return sampleRectLightArea(light, p, u1, u2);
+    }
+
+    LightSample s;
+    if (r.mode == SphericalRect::BEHIND) {
+        s.direction = r.z;
+        s.distance = 0.0f;
+        s.intensity = Vec3(0, 0, 0);
+        return s;
+    }
+
+    // Pick x so that the strip left of it covers u1 of the solid angle
+    float au = u1 * r.solidAngle + r.k;
+    float fu = (std::cos(au) * r.b0 - r.b1) / std::sin(au);
+    float cu = (fu > 0.0f ? 1.0f : -1.0f) / std::sqrt(fu * fu + r.b0 * r.b0);
+    cu = clamp(cu, -1.0f, 1.0f);
+    float xu = -(cu * r.z0) / std::sqrt(std::max(1e-12f, 1.0f - cu * cu));
+    xu = clamp(xu, r.x0, r.x1);
+
+    // Then y, uniform in the projected height of the strip
+    float dist = std::sqrt(xu * xu + r.z0 * r.z0);
+    float h0 = r.y0 / std::sqrt(dist * dist + r.y0 * r.y0);
+    float h1 = r.y1 / std::sqrt(dist * dist + r.y1 * r.y1);
+    float hv = h0 + u2 * (h1 - h0);
+    float hv2 = hv * hv;
+    float yv =
+        hv2 < 1.0f - 1e-6f ? (hv * dist) / std::sqrt(1.0f - hv2) : r.y1;
+
+    Vec3 to_light = r.x * xu + r.y * yv + r.z * r.z0;
+    s.distance = to_light.length();
+    s.direction = to_light / s.distance;
+    s.intensity = light.color * r.solidAngle;
+    return s;
+}
+
+inline LightSample sampleRectLight(const RectLight& light, const Vec3& p,
+                                   float u1, float u2) {
+    return sampleSphericalRect(setupSphericalRect(light, p), light, p, u1,
+                               u2);
+}
+
+// Samples the cone of directions subtended by the sphere uniformly, so no
+// samples are wasted on the half facing away from p. The pdf is
+// 1 / solid angle of the cone.
+inline LightSample sampleSphereLight(const SphereLight& light, const Vec3& p,
+                                     float u1, float u2) {
+    LightSample s;
+    Vec3 to_center = light.center - p;
+    float dist2 = to_center.lengthSquared();
+    float radius2 = light.radius * light.radius;
+    if (dist2 <= radius2) {
+        // Inside the light; nothing sensible to shadow
+        s.direction = Vec3(0, 1, 0);
+        s.distance = 0.0f;
+        s.intensity = Vec3(0, 0, 0);
+        return s;
+    }
+
+    float cos_max = std::sqrt(1.0f - radius2 / dist2);
+    float cos_theta = 1.0f - u1 * (1.0f - cos_max);
+    float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    float phi = 2.0f * PI * u2;
+
+    // Orthonormal basis around the axis to the center
+    Vec3 w = to_center / std::sqrt(dist2);
+    Vec3 a = std::fabs(w.x) > 0.9f ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+    Vec3 u = w.cross(a).normalized();
+    Vec3 v = w.cross(u);
+    s.direction = (u * (std::cos(phi) * sin_theta) +
+                   v * (std::sin(phi) * sin_theta) + w * cos_theta)
+                      .normalized();
+
+    // Distance to the near side of the sphere along the sampled direction
+    float b = s.direction.dot(to_center);
+    float disc = std::max(0.0f, b * b - (dist2 - radius2));
+    s.distance = b - std::sqrt(disc);
+
+    float solid_angle = 2.0f * PI * (1.0f - cos_max);
+    s.intensity = light.color * solid_angle;
+    return s;
+}
+
+// u1, u2 in [0, 1) pick the point on area lights and are ignored otherwise.
+// When drawing several samples from the same point, LightSampler avoids
+// redoing the per-point setup.
+inline LightSample sampleLight(const Light& light, const Vec3& p, float u1,
+                               float u2) {
+    switch (light.type) {
+        case Light::LightType::POINT:
+            return samplePointLight(light.pointLight, p);
+        case Light::LightType::DIRECTIONAL:
+            return sampleDirectionalLight(light.directionalLight);
+        case Light::LightType::SPOT:
+            return sampleSpotLight(light.spotLight, p);
+        case Light::LightType::RECT:
+            return sampleRectLight(light.rectLight, p, u1, u2);
+        case Light::LightType::SPHERE:
+            return sampleSphereLight(light.sphereLight, p, u1, u2);
+        default:
+            return LightSample{Vec3(0, 1, 0), 0.0f, Vec3(0, 0, 0)};
+    }
+}
+
+// Draws samples of one light as seen from one shading point. Setup that only
+// depends on the two is done once in the constructor.
+class LightSampler {
+public:
+    LightSampler(const Light& light, const Vec3& p) : light(light), p(p) {
+        if (light.type == Light::LightType::RECT)
+            rect = setupSphericalRect(light.rectLight, p);
+    }
+
+    LightSample sample(float u1, float u2) const {
+        if (light.type == Light::LightType::RECT)
+            return sampleSphericalRect(rect, light.rectLight, p, u1, u2);
+        return sampleLight(light, p, u1, u2);
+    }
+
+private:
+    const Light& light;
+    Vec3 p;
+    SphericalRect rect;
 };
 
-#endif  // LIGHT_H
\ No newline at end of file
+#endif  // LIGHT_H
@@ -1,71 +1,221 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
 #include "camera.h"
 #include "math_utils.h"
 #include "ppmwriter.h"
+#include "regression.h"
+#include "renderer.h"
 #include "scene.h"
-
-#define PI 3.14159f
+#include "scenes.h"
 
 #define IMG_WIDTH 1920
 #define IMG_HEIGHT 1080
 
-int main() {
+// Stratified samples per pixel, rounded down to a square grid
+#define SAMPLES_PER_PIXEL 4
+// Shadow samples per pixel for each area light, split across the pixel samples
+#define LIGHT_SAMPLES_PER_PIXEL 16
+// 0 disables the denoiser; it is also off above 9 samples per pixel, where it
+// costs more detail than it removes noise
+#define DENOISE 1
+
+// Pixel rows traced together; paged geometry is read once per batch
+#define BATCH_ROWS 16
+// Keep spheres in a paged file instead of memory
+#define OUT_OF_CORE 0
+#define GEOMETRY_FILE "geometry.rlpg"
+#define GEOMETRY_MEMORY_BUDGET (256 << 20)
+
+// Inserts "_diff" before the extension of outputFile, if its file name has
+// one; dots in directory names do not count
+std::string diffFileFor(const std::string& outputFile) {
+    size_t nameStart = outputFile.rfind('/');
+    nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+    size_t dot = outputFile.rfind('.');
+    if (dot == std::string::npos || dot <= nameStart) dot = outputFile.size();
+
+    std::string diffFile = outputFile;
+    diffFile.insert(dot, "_diff");
+    return diffFile;
+}
+
+// Sets up the scene to render: a canned scene, moved to paged geometry if
+// OUT_OF_CORE is set, plus the spheres of geometryFile if one is given
+bool buildScene(Scene& scene, const SceneSetup& setup,
+                const std::string& geometryFile) {
+    if (!setup.build(scene)) {
+        std::cerr << "Failed to set up scene " << setup.name << "\n";
+        return false;
+    }
+    if (!geometryFile.empty()) {
+        if (!scene.openOutOfCore(geometryFile, GEOMETRY_MEMORY_BUDGET)) {
+            std::cerr << "Cannot open geometry file " << geometryFile << "\n";
+            return false;
+        }
+    } else if (OUT_OF_CORE &&
+               !scene.enableOutOfCore(GEOMETRY_FILE, GEOMETRY_MEMORY_BUDGET)) {
+        std::cerr << "Failed to write " << GEOMETRY_FILE << "\n";
+        return false;
+    }
+    return true;
+}
+
+void printStats(const Scene& scene, const Renderer& renderer, int width,
+                int height) {
+    const ShadingStats& stats = scene.getStats();
+    std::cout << "Light samples: " << stats.lightSamples << "\n"
+              << "Shadow rays: " << stats.shadowRays << " ("
+              << double(stats.shadowRays) / (width * height) << " per pixel, "
+              << stats.occludedRays << " occluded)\n";
+
+    // Noise of the raw render. Variance times shadow rays is the cost of a
+    // given noise level, comparable across sampling strategies; lower is
+    // better. It includes pixel footprint variance from the jittered camera
+    // samples, which sampling the lights cannot remove.
+    if (renderer.getSamplesPerPixel() > 1) {
+        double meanVariance = renderer.getMeanVariance();
+        std::cout << "Noise: mean pixel variance " << meanVariance
+                  << " (RMS " << std::sqrt(meanVariance) << "), variance x "
+                  << "shadow rays per pixel "
+                  << meanVariance * stats.shadowRays / (double(width) * height)
+                  << "\n";
+    }
+
+    if (const PagedGeometry* paged = scene.getPagedGeometry()) {
+        const PagedGeometry::Stats& pagedStats = paged->getStats();
+        std::cout << "Geometry pages: " << paged->getPageCount() << " ("
+                  << pagedStats.pageLoads << " loads, "
+                  << pagedStats.pageEvictions << " evictions, "
+                  << (pagedStats.bytesPagedIn >> 20) << " MiB paged in, "
+                  << pagedStats.deferredRays << " deferred rays)\n";
+        if (pagedStats.failedAdvice > 0) {
+            std::cerr << "Warning: " << pagedStats.failedAdvice
+                      << " madvise() calls failed, geometry may exceed its"
+                         " memory budget\n";
+        }
+    }
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " [--output <ppm>] [--scene <name>] [--geometry <rlpg>]"
+                 " [--runs <n>] [--golden <ppm>] [--baseline <file>]"
+                 " [--update]\n"
+              << "  --scene     canned scene to render:";
+    for (const SceneSetup& setup : cannedScenes())
+        std::cerr << " " << setup.name;
+    std::cerr << "\n"
+              << "  --geometry  also render the spheres of a paged geometry\n"
+              << "              file, read from disk as needed\n"
+              << "  --runs      render n times and report the median time\n"
+              << "              of each phase\n"
+              << "  --golden    compare the render against a reference image\n"
+              << "  --baseline  compare the frame times against stored ones\n"
+              << "  --update    store the render and frame times as the new\n"
+              << "              golden image and baseline instead\n";
+}
+
+int main(int argc, char** argv) {
+    std::string outputFile = "output.ppm";
+    std::string sceneName = "box";
+    std::string geometryFile, goldenFile, baselineFile;
+    int runs = 1;
+    bool update = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--output") == 0 && hasValue) {
+            outputFile = argv[++i];
+        } else if (std::strcmp(argv[i], "--scene") == 0 && hasValue) {
+            sceneName = argv[++i];
+        } else if (std::strcmp(argv[i], "--geometry") == 0 && hasValue) {
+            geometryFile = argv[++i];
+        } else if (std::strcmp(argv[i], "--runs") == 0 && hasValue) {
+            runs = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--golden") == 0 && hasValue) {
+            goldenFile = argv[++i];
+        } else if (std::strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            baselineFile = argv[++i];
+        } else if (std::strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    const SceneSetup* setup = findScene(sceneName);
+    if (!setup || runs < 1) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
     int width = IMG_WIDTH;
     int height = IMG_HEIGHT;
+    Camera cam = setup->makeCamera(width, height);
+    Renderer renderer(width, height, SAMPLES_PER_PIXEL,
+                      LIGHT_SAMPLES_PER_PIXEL, BATCH_ROWS);
+
+    // Every run starts from a freshly built scene, so all runs trace the
+    // same rays and render the same image
+    std::vector<double> renderTimes, denoiseTimes;
+    for (int run = 0; run < runs; run++) {
+        Scene scene;
+        if (!buildScene(scene, *setup, geometryFile)) return 1;
+
+        auto start = std::chrono::steady_clock::now();
+        renderer.render(scene, cam);
+        auto rendered = std::chrono::steady_clock::now();
+        if (run == 0) printStats(scene, renderer, width, height);
+
+        auto denoiseStart = std::chrono::steady_clock::now();
+        if (DENOISE) renderer.denoise();
+        auto end = std::chrono::steady_clock::now();
+
+        renderTimes.push_back(
+            std::chrono::duration<double>(rendered - start).count());
+        denoiseTimes.push_back(
+            std::chrono::duration<double>(end - denoiseStart).count());
+    }
+
+    FrameTimes times;
+    times.render = median(renderTimes);
+    times.denoise = median(denoiseTimes);
+    std::cout << "Render time: " << times.render << " s\n"
+              << "Denoise time: " << times.denoise << " s\n";
+    if (runs > 1) std::cout << "(medians of " << runs << " runs)\n";
 
     PPMWriter img(width, height);
-    Camera cam(Vec3(0, 5, 0),                // position
-               Vec3(0, 5, -1),               // lookAt
-               Vec3(0, 1, 0),                // up
-               PI / 4.0f,                    // fov
-               (float)width / (float)height  // aspect ratio
-    );
-
-    Scene scene;
-
-    // Initialize with some default objects
-    scene.addSphere(
-        Sphere(Vec3(0.0f, 1.0f, -20.0f), 1.0f, Vec3(0.88f, 0.64f, 0.47f)));
-    scene.addSphere(
-        Sphere(Vec3(2.0f, 1.5f, -18.0f), 1.5f, Vec3(0.39f, 0.50f, 0.76f)));
-
-    // Floor
-    scene.addPlane(Plane(Vec3(0, 0, 0), Vec3(0, 1, 0), Vec3(1, 1, 1)));
-
-    // Walls
-    scene.addPlane(
-        Plane(Vec3(-5.0f, 0.0f, 0.0f), Vec3(1.0f, 0.0f, 0.0f), Vec3(1, 1, 1)));
-    scene.addPlane(Plane(Vec3(0, 0, -25), Vec3(0, 0, 1), Vec3(1, 1, 1)));
-    scene.addPlane(
-        Plane(Vec3(5.0f, 0.0f, 0.0f), Vec3(-1.0f, 0.0f, 0.0f), Vec3(1, 1, 1)));
-
-    // Ceiling
-    scene.addPlane(
-        Plane(Vec3(0.0f, 10.0f, 0.0f), Vec3(0.0f, -1.0f, 0.0f), Vec3(1, 1, 1)));
-
-    scene.addPointLight(
-        PointLight(Vec3(0.0f, 9.0f, -15.0f), Vec3(1.0f, 1.0f, 1.0f)));
-
-    // x to the right, y up, -z into screen
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            float u = (float(x) + 0.5f) / float(width);
-            float v = (float(y) + 0.5f) / float(height);
-
-            Ray ray = cam.getRay(u, v);
-
-            // Simple gradient based on ray direction
-            Vec3 color = scene.getPixelColor(ray);
-
-            float r = clamp(color.x, 0.0f, 1.0f);
-            float g = clamp(color.y, 0.0f, 1.0f);
-            float b = clamp(color.z, 0.0f, 1.0f);
-
-            img.setPixel(x, y, static_cast<unsigned char>(r * 255),
-                         static_cast<unsigned char>(g * 255),
-                         static_cast<unsigned char>(b * 255));
+    renderer.writeImage(img);
+    if (!img.write(outputFile)) {
+        std::cerr << "Failed to write " << outputFile << "\n";
+        return 1;
+    }
+
+    if (update) {
+        if (!goldenFile.empty() && !img.write(goldenFile)) {
+            std::cerr << "Failed to write " << goldenFile << "\n";
+            return 1;
+        }
+        if (!baselineFile.empty() &&
+            !Baseline::current(times).write(baselineFile)) {
+            std::cerr << "Failed to write " << baselineFile << "\n";
+            return 1;
         }
+        return 0;
     }
 
-    img.write("output.ppm");
-    return 0;
-}
\ No newline at end of file
+    bool pass = true;
+    if (!goldenFile.empty()) {
+        pass = checkGolden(img, goldenFile, diffFileFor(outputFile)) && pass;
+    }
+    if (!baselineFile.empty()) {
+        pass = checkBaseline(times, baselineFile) == BASELINE_PASS && pass;
+    }
+    return pass ? 0 : 1;
+}
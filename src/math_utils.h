@@ -4,6 +4,8 @@
 #include <algorithm>
 #include <cmath>
 
+#define PI 3.14159f
+
 inline float clamp(float value, float minVal, float maxVal) {
     return std::max(minVal, std::min(maxVal, value));
 }
@@ -27,6 +29,9 @@ struct Vec3 {
     Vec3 operator*(const Vec3& v) const {
         return Vec3(x * v.x, y * v.y, z * v.z);
     }
+    Vec3 operator/(const Vec3& v) const {
+        return Vec3(x / v.x, y / v.y, z / v.z);
+    }
 
     Vec3& operator+=(const Vec3& v) {
         x += v.x;
@@ -88,6 +93,11 @@ inline Vec3 min(const Vec3& a, const Vec3& b) {
     return Vec3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
 }
 
+// Rec. 709 luminance of a linear RGB color
+inline float luminance(const Vec3& c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
 // Vec4 - for homogeneous coordinates
 struct Vec4 {
     float x, y, z, w;
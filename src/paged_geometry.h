@@ -0,0 +1,723 @@
+#ifndef PAGED_GEOMETRY_H
+#define PAGED_GEOMETRY_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "math_utils.h"
+#include "ray.h"
+#include "shape.h"
+
+// Spheres are stored on disk as-is, so pages can be used straight from the
+// mapping without decoding.
+static_assert(std::is_trivially_copyable<Sphere>::value,
+              "Sphere must be trivially copyable to be paged");
+
+// A ray waiting on paged geometry. For closest-hit queries tMax shrinks as
+// closer hits are found; for shadow queries hitFound means occluded.
+struct DeferredRay {
+    Ray ray;
+    float tMax;
+    HitRecord hit;  // Valid if hitFound
+    Vec3 color;     // Color of the shape that was hit
+    bool hitFound;
+
+    DeferredRay(const Ray& ray, float tMax)
+        : ray(ray), tMax(tMax), hitFound(false) {}
+};
+
+// Out-of-core sphere storage.
+//
+// PagedGeometryBuilder clusters spheres into pages by splitting them
+// BVH-style along the longest axis, so each page covers a compact region of
+// space, and writes the pages to a file together with the split tree, a
+// top-level BVH whose leaves are the pages. open() memory-maps that file.
+// Only the page table and the tree (one bounding box per page or node) are
+// kept in memory; page contents are paged in on demand and released again
+// in LRU order to stay within the memory budget.
+//
+// Queries take a whole batch of rays. Each ray walks the top-level BVH and
+// is binned into every page whose bounds it crosses, then pages are visited
+// one at a time: resident pages first, then the rest in file order. Rays
+// that need a page that is not resident are deferred until that page comes
+// in, so each page is read once per batch no matter how many rays need it.
+class PagedGeometry {
+public:
+    struct Stats {
+        unsigned long long pageLoads = 0;
+        unsigned long long pageEvictions = 0;
+        unsigned long long bytesPagedIn = 0;
+        unsigned long long deferredRays = 0;  // Ray/page pairs that waited
+        unsigned long long failedAdvice = 0;  // madvise() calls that failed
+    };
+
+    PagedGeometry() = default;
+    ~PagedGeometry() { close(); }
+
+    PagedGeometry(const PagedGeometry&) = delete;
+    PagedGeometry& operator=(const PagedGeometry&) = delete;
+
+    // Maps a file written by PagedGeometryBuilder. memoryBudget caps the
+    // bytes of page data kept resident; at least one page is always allowed.
+    bool open(const std::string& path, size_t memoryBudget) {
+        close();
+
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileHeader)) {
+            close();
+            return false;
+        }
+        mappedSize = static_cast<size_t>(st.st_size);
+
+        void* addr = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            mappedSize = 0;
+            close();
+            return false;
+        }
+        mapped = static_cast<char*>(addr);
+        // Pages are fetched explicitly, readahead would blow the budget
+        if (madvise(addr, mappedSize, MADV_RANDOM) != 0) stats.failedAdvice++;
+
+        FileHeader header;
+        std::memcpy(&header, mapped, sizeof(header));
+        uint64_t tableBytes = uint64_t(header.pageCount) * sizeof(PageInfo) +
+                              uint64_t(header.nodeCount) * sizeof(Node);
+        if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != VERSION || header.tableOffset > mappedSize ||
+            tableBytes > mappedSize - header.tableOffset) {
+            close();
+            return false;
+        }
+
+        // A zero page size would divide by zero below. Eviction hands whole
+        // pages back with madvise(), which fails on ranges that do not start
+        // on a system page, so pages must be aligned to one.
+        uint64_t systemPage = systemPageSize();
+        if (header.pageBytes == 0 || header.pageBytes % systemPage != 0) {
+            close();
+            return false;
+        }
+
+        pageBytes = header.pageBytes;
+        pages.resize(header.pageCount);
+        std::memcpy(pages.data(), mapped + header.tableOffset,
+                    pages.size() * sizeof(PageInfo));
+        // Eviction releases pageBytes per page, so a page must fit in that
+        for (const PageInfo& page : pages) {
+            uint64_t bytes = uint64_t(page.count) * sizeof(Sphere);
+            if (bytes > pageBytes || page.offset % systemPage != 0 ||
+                page.offset > mappedSize ||
+                pageBytes > mappedSize - page.offset) {
+                close();
+                return false;
+            }
+        }
+
+        // Nodes are stored depth-first, so an inner node's left child
+        // directly follows it and its right child comes later still. Checking
+        // that keeps traversal in bounds and free of cycles.
+        nodes.resize(header.nodeCount);
+        std::memcpy(nodes.data(),
+                    mapped + header.tableOffset +
+                        pages.size() * sizeof(PageInfo),
+                    nodes.size() * sizeof(Node));
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const Node& node = nodes[i];
+            bool valid = node.isLeaf ? node.index < pages.size()
+                                     : node.index > i + 1 &&
+                                           node.index < nodes.size();
+            if (!valid) {
+                close();
+                return false;
+            }
+        }
+        if (nodes.empty() != pages.empty()) {
+            close();
+            return false;
+        }
+
+        maxResidentPages = std::max<size_t>(1, memoryBudget / pageBytes);
+        lruPosition.assign(pages.size(), lru.end());
+        return true;
+    }
+
+    void close() {
+        if (mapped) munmap(mapped, mappedSize);
+        if (fd >= 0) ::close(fd);
+        mapped = nullptr;
+        mappedSize = 0;
+        fd = -1;
+        pages.clear();
+        nodes.clear();
+        lru.clear();
+        lruPosition.clear();
+    }
+
+    bool isOpen() const { return mapped != nullptr; }
+
+    // Finds the closest front-facing hit for each ray nearer than its tMax
+    void closestHit(std::vector<DeferredRay>& rays) {
+        processBatch(rays, [](DeferredRay& r, const Sphere* spheres,
+                              uint32_t count) {
+            for (uint32_t i = 0; i < count; i++) {
+                HitRecord rec = intersectSphere(r.ray, spheres[i]);
+                if (rec.t < r.tMax && rec.frontFace) {
+                    r.tMax = rec.t;
+                    r.hit = rec;
+                    r.color = spheres[i].color;
+                    r.hitFound = true;
+                }
+            }
+        });
+    }
+
+    // Sets hitFound on every ray that is blocked before its tMax
+    void anyHit(std::vector<DeferredRay>& rays) {
+        processBatch(rays, [](DeferredRay& r, const Sphere* spheres,
+                              uint32_t count) {
+            for (uint32_t i = 0; i < count && !r.hitFound; i++) {
+                HitRecord rec = intersectSphere(r.ray, spheres[i]);
+                if (rec.t < r.tMax) r.hitFound = true;
+            }
+        });
+    }
+
+    const Stats& getStats() const { return stats; }
+    size_t getPageCount() const { return pages.size(); }
+
+private:
+    friend class PagedGeometryBuilder;
+
+    static constexpr char MAGIC[4] = {'R', 'L', 'P', 'G'};
+    static constexpr uint32_t VERSION = 3;
+    static constexpr uint64_t MIN_ALIGNMENT = 4096;
+
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t pageCount;
+        uint32_t nodeCount;
+        uint64_t pageBytes;
+        uint64_t tableOffset;  // Page table, then the nodes
+    };
+
+    struct PageInfo {
+        Vec3 boundsMin;
+        Vec3 boundsMax;
+        uint64_t offset;  // Byte offset of the page in the file
+        uint32_t count;   // Spheres in this page
+        uint32_t reserved;
+    };
+
+    // Top-level BVH node, stored depth-first with the root first
+    struct Node {
+        Vec3 boundsMin;
+        Vec3 boundsMax;
+        uint32_t index;   // Leaf: page; inner: right child (left is next)
+        uint32_t isLeaf;
+    };
+
+    static uint64_t systemPageSize() {
+        long size = sysconf(_SC_PAGESIZE);
+        return size > 0 ? uint64_t(size) : MIN_ALIGNMENT;
+    }
+
+    // Offsets and sizes in the file are multiples of the system page size,
+    // and of 4 KiB at least so files move between the common hosts
+    static uint64_t alignUp(uint64_t bytes) {
+        uint64_t alignment = std::max(MIN_ALIGNMENT, systemPageSize());
+        return (bytes + alignment - 1) / alignment * alignment;
+    }
+
+    static float component(const Vec3& v, int axis) {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    // Slab test against the box [lo, hi] over [0, tMax)
+    static bool hitsBounds(const Ray& ray, const Vec3& lo, const Vec3& hi,
+                           float tMax) {
+        Vec3 o = ray.getOrigin();
+        Vec3 d = ray.getDirection();
+        float t0 = 0.0f, t1 = tMax;
+        for (int axis = 0; axis < 3; axis++) {
+            float inv = 1.0f / component(d, axis);
+            float tNear = (component(lo, axis) - component(o, axis)) * inv;
+            float tFar = (component(hi, axis) - component(o, axis)) * inv;
+            if (tNear > tFar) std::swap(tNear, tFar);
+            t0 = std::max(t0, tNear);
+            t1 = std::min(t1, tFar);
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+
+    bool isResident(size_t page) const {
+        return lruPosition[page] != lru.end();
+    }
+
+    // Makes a page resident, evicting the least recently used one if the
+    // budget is full, and returns its spheres.
+    const Sphere* acquire(size_t page) {
+        const PageInfo& info = pages[page];
+        char* data = mapped + info.offset;
+
+        if (isResident(page)) {
+            lru.splice(lru.begin(), lru, lruPosition[page]);
+        } else {
+            if (lru.size() >= maxResidentPages) {
+                size_t victim = lru.back();
+                lru.pop_back();
+                lruPosition[victim] = lru.end();
+                // Drop the victim's physical pages; it will fault back in
+                // from the file if it is ever needed again
+                if (madvise(mapped + pages[victim].offset, pageBytes,
+                            MADV_DONTNEED) == 0) {
+                    stats.pageEvictions++;
+                } else {
+                    stats.failedAdvice++;
+                }
+            }
+            if (madvise(data, pageBytes, MADV_WILLNEED) != 0)
+                stats.failedAdvice++;
+            lru.push_front(page);
+            lruPosition[page] = lru.begin();
+            stats.pageLoads++;
+            stats.bytesPagedIn += pageBytes;
+        }
+        return reinterpret_cast<const Sphere*>(data);
+    }
+
+    template <typename Func>
+    void processBatch(std::vector<DeferredRay>& rays, const Func& func) {
+        if (!isOpen() || nodes.empty() || rays.empty()) return;
+
+        // Bin rays by the pages they cross, found by walking the top-level
+        // BVH, so binning costs about log(pages) per ray instead of pages
+        std::vector<std::vector<uint32_t>> bins(pages.size());
+        std::vector<uint32_t> stack;
+        for (size_t r = 0; r < rays.size(); r++) {
+            const DeferredRay& ray = rays[r];
+            stack.assign(1, 0);
+            while (!stack.empty()) {
+                uint32_t index = stack.back();
+                stack.pop_back();
+                const Node& node = nodes[index];
+                if (!hitsBounds(ray.ray, node.boundsMin, node.boundsMax,
+                                ray.tMax))
+                    continue;
+                if (node.isLeaf) {
+                    bins[node.index].push_back(static_cast<uint32_t>(r));
+                } else {
+                    stack.push_back(node.index);
+                    stack.push_back(index + 1);
+                }
+            }
+        }
+
+        // Resident pages first so nothing they hold is evicted before it is
+        // used, then the rest in file order for sequential reads
+        std::vector<size_t> order;
+        for (size_t p : lru) {
+            if (!bins[p].empty()) order.push_back(p);
+        }
+        for (size_t p = 0; p < pages.size(); p++) {
+            if (!bins[p].empty() && !isResident(p)) {
+                order.push_back(p);
+                stats.deferredRays += bins[p].size();
+            }
+        }
+
+        for (size_t p : order) {
+            const Sphere* spheres = acquire(p);
+            for (uint32_t r : bins[p]) {
+                DeferredRay& ray = rays[r];
+                // Earlier pages may have found a closer hit by now
+                if (!hitsBounds(ray.ray, pages[p].boundsMin,
+                                pages[p].boundsMax, ray.tMax))
+                    continue;
+                func(ray, spheres, pages[p].count);
+            }
+        }
+    }
+
+    int fd = -1;
+    char* mapped = nullptr;
+    size_t mappedSize = 0;
+    uint64_t pageBytes = 0;
+    std::vector<PageInfo> pages;
+    std::vector<Node> nodes;
+
+    size_t maxResidentPages = 1;
+    std::list<size_t> lru;  // Resident pages, most recently used first
+    std::vector<std::list<size_t>::iterator> lruPosition;
+
+    Stats stats;
+};
+
+// Writes a file for PagedGeometry::open() from spheres added one at a time,
+// so the full list never has to be in memory.
+//
+// Spheres are buffered until memoryBudget is used up, then spilled to a
+// temporary file next to the output. If nothing was spilled, finish()
+// splits the spheres in memory, cutting at multiples of the page size so
+// pages come out full. Otherwise it splits them on disk: each pass streams
+// a range of the spill file, picks a pivot from a sample of the centers,
+// and partitions the range into a second temporary file. Once a range fits
+// in memory it is loaded and split there. Pages and tree nodes are written
+// as the split reaches them, and the page table and tree are appended at
+// the end. The page where an on-disk range ends may be partly empty.
+class PagedGeometryBuilder {
+public:
+    PagedGeometryBuilder() = default;
+    ~PagedGeometryBuilder() { discard(); }
+
+    PagedGeometryBuilder(const PagedGeometryBuilder&) = delete;
+    PagedGeometryBuilder& operator=(const PagedGeometryBuilder&) = delete;
+
+    // Starts a file at path with pages of at most spheresPerPage spheres.
+    // memoryBudget caps the bytes of spheres held in memory at once.
+    bool open(const std::string& path, int spheresPerPage = 1024,
+              size_t memoryBudget = 256 << 20) {
+        discard();
+        if (spheresPerPage <= 0) return false;
+
+        this->path = path;
+        this->spheresPerPage = spheresPerPage;
+        pageBytes = PagedGeometry::alignUp(uint64_t(spheresPerPage) *
+                                           sizeof(Sphere));
+        maxInMemory = std::max<size_t>(spheresPerPage,
+                                       memoryBudget / sizeof(Sphere));
+        chunkSize = std::max<size_t>(1, maxInMemory / 4);
+
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        // Header placeholder; finish() fills it in once the counts are known
+        std::vector<char> zeros(dataOffset(), 0);
+        out.write(zeros.data(), zeros.size());
+        return bool(out);
+    }
+
+    bool add(const Sphere& sphere) {
+        if (!out.is_open()) return false;
+        // Grow by hand so the buffer never overshoots the budget
+        if (pending.size() == pending.capacity()) {
+            pending.reserve(std::min(
+                maxInMemory, std::max<size_t>(1024, 2 * pending.size())));
+        }
+        pending.push_back(sphere);
+        return pending.size() < maxInMemory || flush();
+    }
+
+    // Clusters everything added so far and completes the file
+    bool finish() {
+        if (!out.is_open()) return false;
+
+        bool ok = true;
+        uint32_t root;
+        if (spilledCount == 0) {
+            if (!pending.empty())
+                ok = splitInMemory(pending, 0, pending.size(), root);
+        } else {
+            ok = flush() && openSpill(1);
+            std::vector<Sphere>().swap(pending);
+            ok = ok && splitOnDisk(0, 0, spilledCount, root);
+        }
+        std::vector<Sphere>().swap(pending);
+
+        PagedGeometry::FileHeader header;
+        std::memcpy(header.magic, PagedGeometry::MAGIC, sizeof(header.magic));
+        header.version = PagedGeometry::VERSION;
+        header.pageCount = static_cast<uint32_t>(pages.size());
+        header.nodeCount = static_cast<uint32_t>(nodes.size());
+        header.pageBytes = pageBytes;
+        header.tableOffset = dataOffset() + pages.size() * pageBytes;
+
+        out.write(reinterpret_cast<const char*>(pages.data()),
+                  pages.size() * sizeof(PagedGeometry::PageInfo));
+        out.write(reinterpret_cast<const char*>(nodes.data()),
+                  nodes.size() * sizeof(PagedGeometry::Node));
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ok = ok && out.good();
+
+        out.close();
+        discard();
+        if (!ok) std::remove(path.c_str());
+        return ok;
+    }
+
+    size_t getSphereCount() const { return spilledCount + pending.size(); }
+
+private:
+    // Spheres sampled per on-disk split to pick the pivot
+    static constexpr size_t PIVOT_SAMPLES = 4096;
+
+    static uint64_t dataOffset() {
+        return PagedGeometry::alignUp(sizeof(PagedGeometry::FileHeader));
+    }
+
+    static int longestAxis(const Vec3& extent) {
+        int axis = 0;
+        if (extent.y > extent.x) axis = 1;
+        if (extent.z > (axis == 0 ? extent.x : extent.y)) axis = 2;
+        return axis;
+    }
+
+    // Closes and removes the temporary files
+    void discard() {
+        if (out.is_open()) {
+            out.close();
+            std::remove(path.c_str());
+        }
+        for (int i = 0; i < 2; i++) {
+            if (spill[i].is_open()) {
+                spill[i].close();
+                std::remove(spillPath(i).c_str());
+            }
+        }
+        pending.clear();
+        spilledCount = 0;
+        pages.clear();
+        nodes.clear();
+    }
+
+    std::string spillPath(int i) const {
+        return path + ".spill" + std::to_string(i);
+    }
+
+    bool openSpill(int i) {
+        if (spill[i].is_open()) return true;
+        spill[i].open(spillPath(i), std::ios::in | std::ios::out |
+                                        std::ios::binary | std::ios::trunc);
+        return spill[i].is_open();
+    }
+
+    // Moves the buffered spheres to the end of the spill file
+    bool flush() {
+        if (pending.empty()) return true;
+        if (!openSpill(0) ||
+            !writeSpheres(spill[0], spilledCount, pending.data(),
+                          pending.size()))
+            return false;
+        spilledCount += pending.size();
+        pending.clear();
+        return true;
+    }
+
+    static bool readSpheres(std::fstream& file, uint64_t first,
+                            Sphere* spheres, size_t count) {
+        file.seekg(first * sizeof(Sphere));
+        file.read(reinterpret_cast<char*>(spheres), count * sizeof(Sphere));
+        return bool(file);
+    }
+
+    static bool writeSpheres(std::fstream& file, uint64_t first,
+                             const Sphere* spheres, size_t count) {
+        file.seekp(first * sizeof(Sphere));
+        file.write(reinterpret_cast<const char*>(spheres),
+                   count * sizeof(Sphere));
+        return bool(file);
+    }
+
+    // Appends a page and the leaf node pointing at it
+    bool writeLeaf(const Sphere* spheres, size_t count, uint32_t& node) {
+        PagedGeometry::PageInfo page;
+        bounds(spheres, count, page.boundsMin, page.boundsMax);
+        page.offset = dataOffset() + pages.size() * pageBytes;
+        page.count = static_cast<uint32_t>(count);
+        page.reserved = 0;
+
+        PagedGeometry::Node leaf;
+        leaf.boundsMin = page.boundsMin;
+        leaf.boundsMax = page.boundsMax;
+        leaf.index = static_cast<uint32_t>(pages.size());
+        leaf.isLeaf = 1;
+
+        std::vector<char> buffer(pageBytes, 0);
+        std::memcpy(buffer.data(), spheres, count * sizeof(Sphere));
+        out.write(buffer.data(), buffer.size());
+
+        node = static_cast<uint32_t>(nodes.size());
+        pages.push_back(page);
+        nodes.push_back(leaf);
+        return bool(out);
+    }
+
+    // Fills in an inner node from its children, which were appended after it
+    void link(uint32_t node, uint32_t left, uint32_t right) {
+        PagedGeometry::Node& inner = nodes[node];
+        inner.boundsMin = min(nodes[left].boundsMin, nodes[right].boundsMin);
+        inner.boundsMax = max(nodes[left].boundsMax, nodes[right].boundsMax);
+        inner.index = right;
+        inner.isLeaf = 0;
+    }
+
+    static void bounds(const Sphere* spheres, size_t count, Vec3& lo,
+                       Vec3& hi) {
+        lo = Vec3(std::numeric_limits<float>::max());
+        hi = Vec3(-std::numeric_limits<float>::max());
+        for (size_t i = 0; i < count; i++) {
+            Vec3 r(spheres[i].radius);
+            lo = min(lo, spheres[i].center - r);
+            hi = max(hi, spheres[i].center + r);
+        }
+    }
+
+    // Median split of spheres[begin, end), writing each leaf as a page.
+    // Sets node to the root of the subtree.
+    bool splitInMemory(std::vector<Sphere>& spheres, size_t begin,
+                       size_t end, uint32_t& node) {
+        if (end - begin <= size_t(spheresPerPage))
+            return writeLeaf(&spheres[begin], end - begin, node);
+
+        Vec3 lo(std::numeric_limits<float>::max());
+        Vec3 hi(-std::numeric_limits<float>::max());
+        for (size_t i = begin; i < end; i++) {
+            lo = min(lo, spheres[i].center);
+            hi = max(hi, spheres[i].center);
+        }
+        int axis = longestAxis(hi - lo);
+
+        // Split on a multiple of the leaf size so pages come out full
+        size_t leaves_left =
+            (end - begin + spheresPerPage - 1) / spheresPerPage / 2;
+        size_t mid = begin + std::max<size_t>(1, leaves_left) * spheresPerPage;
+        std::nth_element(spheres.begin() + begin, spheres.begin() + mid,
+                         spheres.begin() + end,
+                         [axis](const Sphere& a, const Sphere& b) {
+                             return PagedGeometry::component(a.center, axis) <
+                                    PagedGeometry::component(b.center, axis);
+                         });
+
+        node = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(PagedGeometry::Node());
+        uint32_t left, right;
+        if (!splitInMemory(spheres, begin, mid, left) ||
+            !splitInMemory(spheres, mid, end, right))
+            return false;
+        link(node, left, right);
+        return true;
+    }
+
+    // Split of the spheres [begin, end) of spill file src, partitioning into
+    // the same range of the other spill file. Sets node to the root of the
+    // subtree.
+    bool splitOnDisk(int src, uint64_t begin, uint64_t end, uint32_t& node) {
+        uint64_t count = end - begin;
+        if (count <= maxInMemory) {
+            std::vector<Sphere> spheres(count, Sphere(Vec3(0), 0, Vec3(0)));
+            return readSpheres(spill[src], begin, spheres.data(), count) &&
+                   splitInMemory(spheres, 0, spheres.size(), node);
+        }
+
+        uint64_t mid;
+        if (!partition(src, begin, end, mid)) return false;
+
+        int dst = 1 - src;
+        node = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(PagedGeometry::Node());
+        uint32_t left, right;
+        if (!splitOnDisk(dst, begin, mid, left) ||
+            !splitOnDisk(dst, mid, end, right))
+            return false;
+        link(node, left, right);
+        return true;
+    }
+
+    // Moves the spheres [begin, end) of spill file src into the same range
+    // of the other spill file, those below the median center along the
+    // longest axis first, and sets mid to where the rest start. Its buffers
+    // are released before splitOnDisk recurses.
+    bool partition(int src, uint64_t begin, uint64_t end, uint64_t& mid) {
+        uint64_t count = end - begin;
+        std::vector<Sphere> chunk(chunkSize, Sphere(Vec3(0), 0, Vec3(0)));
+
+        // First pass: bounds of the centers and an evenly spaced sample
+        Vec3 lo(std::numeric_limits<float>::max());
+        Vec3 hi(-std::numeric_limits<float>::max());
+        std::vector<Vec3> sample;
+        uint64_t stride = std::max<uint64_t>(1, count / PIVOT_SAMPLES);
+        for (uint64_t i = begin; i < end; i += chunkSize) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(chunkSize,
+                                                              end - i));
+            if (!readSpheres(spill[src], i, chunk.data(), n)) return false;
+            for (size_t j = 0; j < n; j++) {
+                lo = min(lo, chunk[j].center);
+                hi = max(hi, chunk[j].center);
+                if ((i - begin + j) % stride == 0)
+                    sample.push_back(chunk[j].center);
+            }
+        }
+        int axis = longestAxis(hi - lo);
+        auto median = sample.begin() + sample.size() / 2;
+        std::nth_element(sample.begin(), median, sample.end(),
+                         [axis](const Vec3& a, const Vec3& b) {
+                             return PagedGeometry::component(a, axis) <
+                                    PagedGeometry::component(b, axis);
+                         });
+        float pivot = PagedGeometry::component(*median, axis);
+
+        // Second pass: spheres below the pivot go to the front of the range,
+        // the rest to the back. Each chunk is compacted in place, below
+        // first, so no extra buffers are needed.
+        int dst = 1 - src;
+        uint64_t belowEnd = begin, aboveBegin = end;
+        for (uint64_t i = begin; i < end; i += chunkSize) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(chunkSize,
+                                                              end - i));
+            if (!readSpheres(spill[src], i, chunk.data(), n)) return false;
+            auto split = std::partition(
+                chunk.begin(), chunk.begin() + n,
+                [axis, pivot](const Sphere& s) {
+                    return PagedGeometry::component(s.center, axis) < pivot;
+                });
+            size_t below = split - chunk.begin();
+            if (!writeSpheres(spill[dst], belowEnd, chunk.data(), below))
+                return false;
+            belowEnd += below;
+            aboveBegin -= n - below;
+            if (!writeSpheres(spill[dst], aboveBegin, chunk.data() + below,
+                              n - below))
+                return false;
+        }
+
+        // If every center is on one side, they are all equal along the
+        // axis and any split is as good as another
+        mid = belowEnd;
+        if (mid == begin || mid == end) mid = begin + count / 2;
+        return true;
+    }
+
+    std::string path;
+    int spheresPerPage = 0;
+    uint64_t pageBytes = 0;
+    size_t maxInMemory = 0;  // Spheres held in memory at once
+    size_t chunkSize = 1;    // Spheres per read when splitting on disk
+
+    std::ofstream out;
+    std::vector<Sphere> pending;  // Added but not yet spilled
+    std::fstream spill[2];
+    uint64_t spilledCount = 0;
+
+    std::vector<PagedGeometry::PageInfo> pages;
+    std::vector<PagedGeometry::Node> nodes;
+};
+
+#endif  // PAGED_GEOMETRY_H
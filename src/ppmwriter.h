@@ -45,6 +45,37 @@ public:
         return file.good();
     }
 
+    // Loads a binary (P6) PPM with a max value of 255, replacing the current
+    // image. Returns false if the file is missing or not in that format.
+    bool read(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) return false;
+
+        std::string magic;
+        int w = 0, h = 0, maxVal = 0;
+        file >> magic >> w >> h >> maxVal;
+        if (!file || magic != "P6" || w <= 0 || h <= 0 || maxVal != 255)
+            return false;
+        file.get();  // Single whitespace before the pixel data
+
+        std::vector<RGB> data(static_cast<size_t>(w) * h);
+        file.read(reinterpret_cast<char*>(data.data()), data.size() * 3);
+        if (!file) return false;
+
+        width = w;
+        height = h;
+        pixels.swap(data);
+        return true;
+    }
+
+    void getPixel(int x, int y, unsigned char& r, unsigned char& g,
+                  unsigned char& b) const {
+        const RGB& pixel = pixels[y * width + x];
+        r = pixel.r;
+        g = pixel.g;
+        b = pixel.b;
+    }
+
     void clear(unsigned char r = 0, unsigned char g = 0, unsigned char b = 0) {
         std::fill(pixels.begin(), pixels.end(), RGB{r, g, b});
     }
@@ -0,0 +1,238 @@
+#ifndef REGRESSION_H
+#define REGRESSION_H
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_compare.h"
+#include "ppmwriter.h"
+
+// Regression thresholds, used by the golden image and frame time checks
+#define GOLDEN_TOLERANCE 2           // Max per-channel difference per pixel
+#define GOLDEN_MAX_MISMATCH 0.001    // Fraction of pixels allowed over it
+#define GOLDEN_MIN_PSNR 40.0         // dB
+#define BASELINE_SLACK 0.002         // Seconds, for millisecond-scale phases
+
+// Default allowed time increase per phase, as a fraction of the baseline.
+// Even as medians of several runs, frame times on shared or virtualised
+// hosts drift by up to ~80% between runs, so only a 2x slowdown fails. On a
+// dedicated machine, configure CMake with -DFRAME_TIME_MAX_SLOWDOWN=0.2 to
+// lower it for both renderlab and regression_test.
+#ifndef BASELINE_MAX_SLOWDOWN
+#define BASELINE_MAX_SLOWDOWN 1.0
+#endif
+
+// Returns true if the render matches the golden image closely enough.
+// Writes a visualisation of the differences to diffFile.
+bool checkGolden(const PPMWriter& img, const std::string& goldenFile,
+                 const std::string& diffFile) {
+    PPMWriter golden(1, 1);
+    if (!golden.read(goldenFile)) {
+        std::cerr << "Cannot read golden image " << goldenFile << "\n";
+        return false;
+    }
+
+    PPMWriter diff(1, 1);
+    ImageDiff result = compareImages(img, golden, GOLDEN_TOLERANCE, &diff);
+    if (!result.sizeMatches) {
+        std::cerr << "Golden image " << goldenFile << " is "
+                  << golden.getWidth() << "x" << golden.getHeight()
+                  << ", render is " << img.getWidth() << "x"
+                  << img.getHeight() << "\n";
+        return false;
+    }
+    if (!diff.write(diffFile)) {
+        std::cerr << "Failed to write " << diffFile << "\n";
+        return false;
+    }
+
+    double mismatch = double(result.mismatchedPixels) /
+                      (double(img.getWidth()) * img.getHeight());
+    std::cout << "Golden diff: max error " << result.maxError << ", "
+              << result.mismatchedPixels << " pixels over tolerance ("
+              << mismatch * 100.0 << "%), PSNR " << result.psnr << " dB\n";
+
+    bool pass = mismatch <= GOLDEN_MAX_MISMATCH &&
+                result.psnr >= GOLDEN_MIN_PSNR;
+    if (!pass) std::cerr << "Image regression, see " << diffFile << "\n";
+    return pass;
+}
+
+// How this binary was compiled, set by the CMake build. Frame times only
+// compare between binaries built the same way.
+#ifndef RENDERLAB_BUILD_TYPE
+#define RENDERLAB_BUILD_TYPE "unknown"
+#endif
+#ifndef RENDERLAB_COMPILER
+#ifdef __VERSION__
+#define RENDERLAB_COMPILER __VERSION__
+#else
+#define RENDERLAB_COMPILER "unknown"
+#endif
+#endif
+#ifndef RENDERLAB_CXX_FLAGS
+#define RENDERLAB_CXX_FLAGS ""
+#endif
+
+// Time spent in each phase of a frame, in seconds
+struct FrameTimes {
+    double render = 0.0;
+    double denoise = 0.0;
+};
+
+// Median of several runs, so a run that was descheduled or hit a cold cache
+// does not decide the result
+inline double median(std::vector<double> values) {
+    if (values.empty()) return 0.0;
+    size_t mid = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + mid, values.end());
+    double upper = values[mid];
+    if (values.size() % 2 == 1) return upper;
+    double lower = *std::max_element(values.begin(), values.begin() + mid);
+    return (lower + upper) / 2.0;
+}
+
+// Frame times together with the machine and build they were measured on.
+// Times are only compared when all of those match, since on other hardware
+// or from a build with other optimizations they say nothing about the code.
+struct Baseline {
+    std::string host;
+    unsigned threads = 0;
+    std::string buildType;
+    std::string compiler;
+    std::string flags;
+    FrameTimes times;
+
+    static Baseline current(const FrameTimes& times) {
+        Baseline baseline;
+        char name[256] = {};
+        if (gethostname(name, sizeof(name) - 1) == 0) baseline.host = name;
+        if (baseline.host.empty()) baseline.host = "unknown";
+        baseline.threads = std::thread::hardware_concurrency();
+        baseline.buildType = RENDERLAB_BUILD_TYPE;
+        baseline.compiler = RENDERLAB_COMPILER;
+        baseline.flags = RENDERLAB_CXX_FLAGS;
+        baseline.times = times;
+        return baseline;
+    }
+
+    bool comparable(const Baseline& other) const {
+        return host == other.host && threads == other.threads &&
+               buildType == other.buildType && compiler == other.compiler &&
+               flags == other.flags;
+    }
+
+    std::string describe() const {
+        std::ostringstream out;
+        out << host << " with " << threads << " threads, " << buildType
+            << " build by " << compiler << " (flags \"" << flags << "\")";
+        return out.str();
+    }
+
+    // One "key value" pair per line; a value runs to the end of its line
+    bool read(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file) return false;
+
+        bool hasHost = false, hasThreads = false, hasBuildType = false;
+        bool hasCompiler = false, hasFlags = false;
+        bool hasRender = false, hasDenoise = false;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty()) continue;
+            size_t space = line.find(' ');
+            std::string key = line.substr(0, space);
+            std::string value =
+                space == std::string::npos ? "" : line.substr(space + 1);
+            std::istringstream in(value);
+            if (key == "host") {
+                host = value;
+                hasHost = !value.empty();
+            } else if (key == "threads") {
+                hasThreads = bool(in >> threads);
+            } else if (key == "build") {
+                buildType = value;
+                hasBuildType = true;
+            } else if (key == "compiler") {
+                compiler = value;
+                hasCompiler = true;
+            } else if (key == "flags") {
+                flags = value;
+                hasFlags = true;
+            } else if (key == "render") {
+                hasRender = bool(in >> times.render);
+            } else if (key == "denoise") {
+                hasDenoise = bool(in >> times.denoise);
+            } else {
+                return false;
+            }
+        }
+        return hasHost && hasThreads && hasBuildType && hasCompiler &&
+               hasFlags && hasRender && hasDenoise && times.render > 0.0 &&
+               times.denoise >= 0.0;
+    }
+
+    bool write(const std::string& filename) const {
+        std::ofstream file(filename);
+        file << "host " << host << "\n"
+             << "threads " << threads << "\n"
+             << "build " << buildType << "\n"
+             << "compiler " << compiler << "\n"
+             << "flags " << flags << "\n"
+             << "render " << times.render << "\n"
+             << "denoise " << times.denoise << "\n";
+        return bool(file);
+    }
+};
+
+enum BaselineResult {
+    BASELINE_PASS,
+    BASELINE_SLOWER,       // A phase exceeded its limit
+    BASELINE_OTHER_BUILD,  // Recorded on another machine or build
+    BASELINE_UNREADABLE
+};
+
+// Compares each phase of times against the baseline in baselineFile. A
+// phase may be maxSlowdown slower, plus BASELINE_SLACK so that phases of a
+// few milliseconds do not fail on timer noise.
+BaselineResult checkBaseline(const FrameTimes& times,
+                             const std::string& baselineFile,
+                             double maxSlowdown = BASELINE_MAX_SLOWDOWN) {
+    Baseline baseline;
+    if (!baseline.read(baselineFile)) {
+        std::cerr << "Cannot read baseline " << baselineFile << "\n";
+        return BASELINE_UNREADABLE;
+    }
+
+    Baseline current = Baseline::current(times);
+    if (!current.comparable(baseline)) {
+        std::cerr << "Baseline " << baselineFile << " was recorded on "
+                  << baseline.describe() << ", this is "
+                  << current.describe() << "; record a new one with --update\n";
+        return BASELINE_OTHER_BUILD;
+    }
+
+    bool pass = true;
+    const char* names[2] = {"Render", "Denoise"};
+    double measured[2] = {times.render, times.denoise};
+    double recorded[2] = {baseline.times.render, baseline.times.denoise};
+    for (int i = 0; i < 2; i++) {
+        double limit = recorded[i] * (1.0 + maxSlowdown) + BASELINE_SLACK;
+        std::cout << names[i] << " time: " << measured[i] << " s (baseline "
+                  << recorded[i] << " s, limit " << limit << " s)\n";
+        if (measured[i] > limit) {
+            std::cerr << names[i] << " performance regression\n";
+            pass = false;
+        }
+    }
+    return pass ? BASELINE_PASS : BASELINE_SLOWER;
+}
+
+#endif  // REGRESSION_H
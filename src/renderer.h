@@ -0,0 +1,159 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "camera.h"
+#include "denoiser.h"
+#include "math_utils.h"
+#include "ppmwriter.h"
+#include "scene.h"
+
+// Traces a scene into color, normal, albedo and variance buffers and turns
+// them into an image. Pixels get stratified, jittered samples; rows are
+// traced in batches so paged geometry is read once per batch. Renders are
+// deterministic, so the same scene renders the same image every time.
+class Renderer {
+public:
+    // samplesPerPixel is rounded down to a square grid. lightSamplesPerPixel
+    // shadow samples per area light are split across a pixel's samples.
+    Renderer(int width, int height, int samplesPerPixel = 4,
+             int lightSamplesPerPixel = 16, int batchRows = 16)
+        : width(width),
+          height(height),
+          strata(std::max(1, (int)std::sqrt((float)samplesPerPixel))),
+          lightSamplesPerPixel(lightSamplesPerPixel),
+          batchRows(std::max(1, batchRows)) {}
+
+    void render(Scene& scene, const Camera& camera) {
+        int spp = getSamplesPerPixel();
+        scene.setAreaLightSamples(lightSamplesPerPixel / spp);
+
+        size_t count = static_cast<size_t>(width) * height;
+        colorBuffer.assign(count, Vec3(0, 0, 0));
+        normalBuffer.assign(count, Vec3(0, 0, 0));
+        albedoBuffer.assign(count, Vec3(0, 0, 0));
+        varianceBuffer.assign(count, 0.0f);
+
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> jitter(0.0f, 1.0f);
+
+        std::vector<Ray> rays;
+        std::vector<Vec3> colors, normals, albedos;
+
+        // x to the right, y up, -z into screen
+        for (int y0 = 0; y0 < height; y0 += batchRows) {
+            int y1 = std::min(y0 + batchRows, height);
+
+            rays.clear();
+            for (int y = y0; y < y1; y++) {
+                for (int x = 0; x < width; x++) {
+                    for (int sy = 0; sy < strata; sy++) {
+                        for (int sx = 0; sx < strata; sx++) {
+                            float u = (float(x) + (sx + jitter(rng)) / strata) /
+                                      float(width);
+                            float v = (float(y) + (sy + jitter(rng)) / strata) /
+                                      float(height);
+                            rays.push_back(camera.getRay(u, v));
+                        }
+                    }
+                }
+            }
+
+            scene.getPixelColors(rays, colors, normals, albedos);
+
+            // Average the samples of each pixel; they are stored consecutively
+            size_t s = 0;
+            for (int y = y0; y < y1; y++) {
+                for (int x = 0; x < width; x++) {
+                    Vec3 color(0, 0, 0), normal(0, 0, 0), albedo(0, 0, 0);
+                    float lumSquares = 0.0f;
+                    bool mixed = false;
+                    for (int i = 0; i < spp; i++, s++) {
+                        mixed = mixed || (albedos[s] - albedos[s - i])
+                                                 .lengthSquared() > 1e-4f;
+                        color += colors[s];
+                        lumSquares +=
+                            luminance(colors[s]) * luminance(colors[s]);
+                        normal += normals[s];
+                        albedo += albedos[s];
+                    }
+
+                    int idx = y * width + x;
+                    colorBuffer[idx] = color / float(spp);
+                    // Samples on surfaces of different albedo straddle an
+                    // edge even where the normals agree, e.g. a sphere's
+                    // silhouette against the floor. A zero normal tells
+                    // the denoiser to leave the pixel alone.
+                    normalBuffer[idx] =
+                        mixed ? Vec3(0, 0, 0) : normal / float(spp);
+                    albedoBuffer[idx] = albedo / float(spp);
+                    if (spp > 1) {
+                        float mean = luminance(color) / float(spp);
+                        float sampleVariance =
+                            (lumSquares - spp * mean * mean) / float(spp - 1);
+                        varianceBuffer[idx] =
+                            std::max(0.0f, sampleVariance) / float(spp);
+                    }
+                }
+            }
+        }
+    }
+
+    // Filters the last render in place, with as many passes as pay off at
+    // its sample count; see Denoiser::iterationsFor()
+    void denoise() {
+        int iterations = Denoiser::iterationsFor(getSamplesPerPixel());
+        if (iterations <= 0) return;
+        Denoiser denoiser(width, height, iterations);
+        // With one sample per pixel there is no variance estimate; the
+        // denoiser then estimates it spatially
+        denoiser.denoise(colorBuffer, normalBuffer, albedoBuffer,
+                         getSamplesPerPixel() > 1 ? varianceBuffer
+                                                  : std::vector<float>());
+    }
+
+    void writeImage(PPMWriter& img) const {
+        img = PPMWriter(width, height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                Vec3 color = colorBuffer[y * width + x];
+
+                float r = clamp(color.x, 0.0f, 1.0f);
+                float g = clamp(color.y, 0.0f, 1.0f);
+                float b = clamp(color.z, 0.0f, 1.0f);
+
+                img.setPixel(x, y, static_cast<unsigned char>(r * 255),
+                             static_cast<unsigned char>(g * 255),
+                             static_cast<unsigned char>(b * 255));
+            }
+        }
+    }
+
+    int getSamplesPerPixel() const { return strata * strata; }
+
+    // Mean over all pixels of the variance of the pixel's raw mean, from
+    // the last render. Zero with one sample per pixel.
+    double getMeanVariance() const {
+        double sum = 0.0;
+        for (float v : varianceBuffer) sum += v;
+        return varianceBuffer.empty() ? 0.0 : sum / varianceBuffer.size();
+    }
+
+private:
+    int width, height;
+    int strata;
+    int lightSamplesPerPixel;
+    int batchRows;
+
+    std::vector<Vec3> colorBuffer;
+    std::vector<Vec3> normalBuffer;
+    std::vector<Vec3> albedoBuffer;
+    // Variance of each pixel's mean luminance, estimated from its samples
+    std::vector<float> varianceBuffer;
+};
+
+#endif  // RENDERER_H
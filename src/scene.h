@@ -1,10 +1,16 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
 #include <vector>
 
 #include "light.h"
 #include "math_utils.h"
+#include "paged_geometry.h"
 #include "ray.h"
 #include "shading.h"
 #include "shape.h"
@@ -15,24 +21,113 @@ public:
     ~Scene() = default;
 
     Vec3 getPixelColor(const Ray& ray) {
+        Vec3 normal, albedo;
+        return getPixelColor(ray, normal, albedo);
+    }
+
+    // Same as above, but also writes out the normal and albedo at the first
+    // hit. These feed the denoiser as guide buffers; both are zero on a miss.
+    Vec3 getPixelColor(const Ray& ray, Vec3& normal, Vec3& albedo) {
+        if (paged) {
+            // Paged geometry only works in batches; this is a batch of one
+            std::vector<Vec3> colors, normals, albedos;
+            getPixelColors(std::vector<Ray>{ray}, colors, normals, albedos);
+            normal = normals[0];
+            albedo = albedos[0];
+            return colors[0];
+        }
+
         HitRecord closestHit;
-        closestHit.t = std::numeric_limits<float>::max();
+        size_t hitID = findClosestHit(ray, closestHit);
 
-        // Check intersection with all spheres
-        size_t hitID = -1;
-        for (size_t i = 0; i < shapes.size(); i++) {
-            HitRecord rec = shapes[i].intersect(ray);
-            // Process hit record to determine color
-            if (rec.t < closestHit.t && rec.frontFace) {
-                hitID = i;
-                closestHit = rec;
+        // If no hit, return background color
+        if (hitID == NO_HIT) {
+            normal = Vec3(0, 0, 0);
+            albedo = Vec3(0, 0, 0);
+            return Vec3(0, 0, 0);  // Sky blue
+        }
+
+        normal = closestHit.normal;
+        albedo = shapes[hitID].getColor();
+        return phongShading(closestHit, albedo, ray, lights, shapes,
+                            areaLightSamples, rng, stats);
+    }
+
+    // Batched version of getPixelColor. With out-of-core geometry enabled,
+    // primary and shadow rays are collected for the whole batch and handed to
+    // the paged geometry together, so page I/O is shared across the batch.
+    void getPixelColors(const std::vector<Ray>& rays, std::vector<Vec3>& colors,
+                        std::vector<Vec3>& normals,
+                        std::vector<Vec3>& albedos) {
+        size_t count = rays.size();
+        colors.assign(count, Vec3(0, 0, 0));
+        normals.assign(count, Vec3(0, 0, 0));
+        albedos.assign(count, Vec3(0, 0, 0));
+
+        // Primary hits: in-core shapes first, then paged spheres
+        std::vector<DeferredRay> primary;
+        primary.reserve(count);
+        for (const Ray& ray : rays) {
+            DeferredRay r(ray, std::numeric_limits<float>::max());
+            size_t hitID = findClosestHit(ray, r.hit);
+            if (hitID != NO_HIT) {
+                r.tMax = r.hit.t;
+                r.color = shapes[hitID].getColor();
+                r.hitFound = true;
             }
+            primary.push_back(r);
         }
+        if (paged) paged->closestHit(primary);
 
-        // If no hit, return background color
-        if (hitID == -1) return Vec3(0, 0, 0);  // Sky blue
+        // Shade with the same sample/resolve steps as phongShading. Shadow
+        // rays that clear the in-core shapes still have to be tested against
+        // paged spheres, so with paged geometry each point's queries are
+        // kept and resolved once the whole batch has been traced.
+        std::vector<ShadowQuery> queries;
+        std::vector<size_t> queryBegin(count + 1, 0);
+        std::vector<DeferredRay> shadowRays;
+        std::vector<size_t> shadowQueries;
+        for (size_t i = 0; i < count; i++) {
+            queryBegin[i] = queries.size();
+            const DeferredRay& r = primary[i];
+            if (!r.hitFound) continue;
 
-        return phongShading(closestHit, shapes[hitID].getColor(), ray, lights);
+            normals[i] = r.hit.normal;
+            albedos[i] = r.color;
+            phongSample(r.hit, r.color, r.ray, lights, areaLightSamples, rng,
+                        stats, queries);
+            for (size_t j = queryBegin[i]; j < queries.size(); j++) {
+                ShadowQuery& query = queries[j];
+                query.occluded = isOccluded(query.ray, query.max_dist, shapes);
+                if (paged && !query.occluded) {
+                    shadowRays.push_back(
+                        DeferredRay(query.ray, query.max_dist));
+                    shadowQueries.push_back(j);
+                }
+            }
+
+            if (!paged) {
+                colors[i] = phongResolve(r.color,
+                                         queries.data() + queryBegin[i],
+                                         queries.size() - queryBegin[i],
+                                         stats);
+                queries.clear();
+            }
+        }
+        if (!paged) return;
+        queryBegin[count] = queries.size();
+
+        paged->anyHit(shadowRays);
+        for (size_t j = 0; j < shadowRays.size(); j++) {
+            queries[shadowQueries[j]].occluded = shadowRays[j].hitFound;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (!primary[i].hitFound) continue;
+            colors[i] = phongResolve(primary[i].color,
+                                     queries.data() + queryBegin[i],
+                                     queryBegin[i + 1] - queryBegin[i], stats);
+        }
     }
 
     void addSphere(const Sphere& sphere) {
@@ -48,10 +143,90 @@ public:
         lights.push_back(
             Light(Light::LightType::DIRECTIONAL, directionallight));
     }
+    void addSpotLight(const SpotLight& spotlight) {
+        lights.push_back(Light(Light::LightType::SPOT, spotlight));
+    }
+    void addRectLight(const RectLight& rectlight) {
+        lights.push_back(Light(Light::LightType::RECT, rectlight));
+    }
+    void addSphereLight(const SphereLight& spherelight) {
+        lights.push_back(Light(Light::LightType::SPHERE, spherelight));
+    }
+
+    // Moves every sphere added so far out of memory into a paged file at
+    // path, keeping at most memoryBudget bytes of it resident. Planes stay
+    // in memory. On failure, or if paged geometry is already in use, the
+    // scene is left unchanged.
+    bool enableOutOfCore(const std::string& path, size_t memoryBudget,
+                         int spheresPerPage = 1024) {
+        if (paged) return false;
+
+        PagedGeometryBuilder builder;
+        if (!builder.open(path, spheresPerPage, memoryBudget)) return false;
+        std::vector<Shape> remaining;
+        for (const Shape& shape : shapes) {
+            if (shape.type == Shape::ShapeType::SPHERE) {
+                if (!builder.add(shape.sphere)) return false;
+            } else {
+                remaining.push_back(shape);
+            }
+        }
+
+        auto geometry = std::make_unique<PagedGeometry>();
+        if (!builder.finish() || !geometry->open(path, memoryBudget))
+            return false;
+
+        shapes = std::move(remaining);
+        paged = std::move(geometry);
+        return true;
+    }
+
+    // Adds the spheres of an existing paged file, for example one written
+    // with PagedGeometryBuilder for a scene that does not fit in memory.
+    // Shapes added so far stay in memory. Replaces any paged geometry in use.
+    bool openOutOfCore(const std::string& path, size_t memoryBudget) {
+        auto geometry = std::make_unique<PagedGeometry>();
+        if (!geometry->open(path, memoryBudget)) return false;
+        paged = std::move(geometry);
+        return true;
+    }
+
+    // Null unless out-of-core geometry is enabled
+    const PagedGeometry* getPagedGeometry() const { return paged.get(); }
+
+    // Shadow samples per area light at each shading point
+    void setAreaLightSamples(int samples) {
+        areaLightSamples = std::max(1, samples);
+    }
+    const ShadingStats& getStats() const { return stats; }
 
 private:
     std::vector<Light> lights;
     std::vector<Shape> shapes;
+
+    int areaLightSamples = 16;
+    std::mt19937 rng{0};
+    ShadingStats stats;
+
+    std::unique_ptr<PagedGeometry> paged;
+
+    static constexpr size_t NO_HIT = static_cast<size_t>(-1);
+
+    // Closest front-facing hit among the in-core shapes. Returns the index of
+    // the shape that was hit, or NO_HIT if none.
+    size_t findClosestHit(const Ray& ray, HitRecord& closestHit) const {
+        closestHit.t = std::numeric_limits<float>::max();
+
+        size_t hitID = NO_HIT;
+        for (size_t i = 0; i < shapes.size(); i++) {
+            HitRecord rec = shapes[i].intersect(ray);
+            if (rec.t < closestHit.t && rec.frontFace) {
+                hitID = i;
+                closestHit = rec;
+            }
+        }
+        return hitID;
+    }
 };
 
 #endif  // SCENE_H
\ No newline at end of file
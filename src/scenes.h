@@ -0,0 +1,119 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "light.h"
+#include "math_utils.h"
+#include "scene.h"
+#include "shape.h"
+
+// A canned scene: how to fill an empty Scene and where to put the camera.
+// The renderer picks one by name, and the regression test renders each of
+// them against its golden image.
+struct SceneSetup {
+    const char* name;
+    Vec3 cameraPosition;
+    Vec3 cameraLookAt;
+    bool (*build)(Scene& scene);  // false if the scene could not be set up
+
+    Camera makeCamera(int width, int height) const {
+        return Camera(cameraPosition, cameraLookAt, Vec3(0, 1, 0), PI / 4.0f,
+                      (float)width / (float)height);
+    }
+};
+
+// Floor, three walls and a ceiling around the camera
+inline void addRoom(Scene& scene) {
+    // Floor
+    scene.addPlane(Plane(Vec3(0, 0, 0), Vec3(0, 1, 0), Vec3(1, 1, 1)));
+
+    // Walls
+    scene.addPlane(
+        Plane(Vec3(-5.0f, 0.0f, 0.0f), Vec3(1.0f, 0.0f, 0.0f), Vec3(1, 1, 1)));
+    scene.addPlane(Plane(Vec3(0, 0, -25), Vec3(0, 0, 1), Vec3(1, 1, 1)));
+    scene.addPlane(
+        Plane(Vec3(5.0f, 0.0f, 0.0f), Vec3(-1.0f, 0.0f, 0.0f), Vec3(1, 1, 1)));
+
+    // Ceiling
+    scene.addPlane(
+        Plane(Vec3(0.0f, 10.0f, 0.0f), Vec3(0.0f, -1.0f, 0.0f), Vec3(1, 1, 1)));
+}
+
+// Two spheres in the room, lit by a panel in the ceiling
+inline bool buildBoxScene(Scene& scene) {
+    scene.addSphere(
+        Sphere(Vec3(0.0f, 1.0f, -20.0f), 1.0f, Vec3(0.88f, 0.64f, 0.47f)));
+    scene.addSphere(
+        Sphere(Vec3(2.0f, 1.5f, -18.0f), 1.5f, Vec3(0.39f, 0.50f, 0.76f)));
+    addRoom(scene);
+
+    // 2x2 panel facing down, centered where the point light used to be
+    scene.addRectLight(RectLight(Vec3(-1.0f, 9.0f, -16.0f),
+                                 Vec3(2.0f, 0.0f, 0.0f),
+                                 Vec3(0.0f, 0.0f, 2.0f),
+                                 Vec3(25.0f, 25.0f, 25.0f)));
+    return true;
+}
+
+// A row of spheres under a spot light, a sphere light and a dim point light,
+// so every light type but the panel is covered
+inline bool buildLightsScene(Scene& scene) {
+    for (int i = 0; i < 5; i++) {
+        float x = -3.0f + 1.5f * i;
+        scene.addSphere(Sphere(Vec3(x, 0.6f, -17.0f + 0.5f * (i % 2)), 0.6f,
+                               Vec3(0.3f + 0.15f * i, 0.8f - 0.1f * i,
+                                    0.5f)));
+    }
+    addRoom(scene);
+
+    scene.addSpotLight(SpotLight(Vec3(-2.0f, 8.0f, -14.0f),
+                                 Vec3(0.3f, -1.0f, -0.4f),
+                                 Vec3(1.6f, 1.4f, 1.1f), 0.25f, 0.45f));
+    scene.addSphereLight(SphereLight(Vec3(3.0f, 4.0f, -15.0f), 0.5f,
+                                     Vec3(6.0f, 7.0f, 9.0f)));
+    scene.addPointLight(
+        PointLight(Vec3(0.0f, 9.0f, -5.0f), Vec3(0.15f, 0.15f, 0.15f)));
+    return true;
+}
+
+// A grid of small spheres moved to paged geometry with a memory budget of a
+// few pages, so building on disk, the top-level BVH and eviction all run
+inline bool buildPagedScene(Scene& scene) {
+    for (int z = 0; z < 20; z++) {
+        for (int x = 0; x < 20; x++) {
+            Vec3 center(-4.0f + 0.42f * x, 0.18f, -24.0f + 0.5f * z);
+            Vec3 color(0.3f + 0.03f * x, 0.4f, 0.3f + 0.03f * z);
+            scene.addSphere(Sphere(center, 0.18f, color));
+        }
+    }
+    addRoom(scene);
+
+    scene.addRectLight(RectLight(Vec3(-1.5f, 9.0f, -19.0f),
+                                 Vec3(3.0f, 0.0f, 0.0f),
+                                 Vec3(0.0f, 0.0f, 3.0f),
+                                 Vec3(12.0f, 12.0f, 12.0f)));
+    return scene.enableOutOfCore("paged_scene.rlpg", 8 << 10, 16);
+}
+
+inline const std::vector<SceneSetup>& cannedScenes() {
+    static const std::vector<SceneSetup> scenes = {
+        {"box", Vec3(0, 5, 0), Vec3(0, 5, -1), buildBoxScene},
+        {"lights", Vec3(0, 4, -2), Vec3(0, 2, -16), buildLightsScene},
+        {"paged", Vec3(0, 5, -8), Vec3(0, 0, -18), buildPagedScene},
+    };
+    return scenes;
+}
+
+// Null if there is no scene called name
+inline const SceneSetup* findScene(const std::string& name) {
+    for (const SceneSetup& setup : cannedScenes()) {
+        if (name == setup.name) return &setup;
+    }
+    return nullptr;
+}
+
+#endif  // SCENES_H
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <random>
 #include <vector>
 
 #include "light.h"
@@ -17,35 +18,136 @@ Vec3 simpleShading(const HitRecord& rec, const Vec3& shape_color) {
          shape_color;
 }
 
-Vec3 phongShading(const HitRecord& rec, const Vec3& shape_color, const Ray& ray,
-                  const std::vector<Light>& lights) {
+// Counters for judging how well light sampling spends its shadow rays
+struct ShadingStats {
+  unsigned long long lightSamples = 0;  // Samples drawn from lights
+  unsigned long long shadowRays = 0;    // Samples that needed a shadow ray
+  unsigned long long occludedRays = 0;  // Shadow rays that hit something
+};
+
+// Diffuse + specular response to light arriving from light_dir
+Vec3 phongBRDF(const HitRecord& rec, const Vec3& shape_color, const Ray& ray,
+               const Vec3& light_dir, const Vec3& intensity) {
   Vec3 N = rec.normal;
 
-  // Ambient
-  Vec3 ambient = shape_color * 0.1;
+  // Diffuse
+  float diff = std::max(N.dot(light_dir), 0.0f);
+  Vec3 diffuse = shape_color * diff;
+
+  // Specular
+  Vec3 reflect_dir = light_dir.reflect(N);
+  float dotProduct = ray.getDirection().dot(reflect_dir);
+  float spec = std::pow((dotProduct > 0 ? dotProduct : 0), 32);
+  Vec3 specular = shape_color * spec;
+
+  return (diffuse + specular) * intensity;
+}
+
+Vec3 ambientShading(const Vec3& shape_color) { return shape_color * 0.1; }
+
+// Origin for shadow rays, offset to avoid hitting the surface itself
+Vec3 shadowRayOrigin(const HitRecord& rec) {
+  return rec.point + rec.normal * 1e-3f;
+}
+
+// Draws light samples for a shading point and calls func(sample, weight) for
+// each one that could contribute, i.e. that faces the surface and carries
+// some light. Only those need a shadow ray. area_samples is the number of
+// samples spent on each area light, rounded down to a square so they can be
+// stratified over the light.
+template <typename Func>
+void sampleLights(const HitRecord& rec, const std::vector<Light>& lights,
+                  int area_samples, std::mt19937& rng, ShadingStats& stats,
+                  const Func& func) {
+  Vec3 N = rec.normal;
+  std::uniform_real_distribution<float> jitter(0.0f, 1.0f);
 
-  Vec3 light_contribution(0, 0, 0);
   for (size_t i = 0; i < lights.size(); i++) {
-    Light light = lights[i];
-    if (light.type == Light::LightType::POINT) {
-      // Diffuse
-      Vec3 light_dir = light.pointLight.position -
-                       rec.point;  // Direction from hit point to light
-      float diff = (N.dot(light_dir) > 0.0f)
-                       ? (N.dot(light_dir) / light_dir.length())
-                       : 0.0f;
-      Vec3 diffuse = shape_color * diff;
-
-      // Specular
-      Vec3 reflect_dir = light_dir.reflect(N);
-      float dotProduct = ray.getDirection().dot(reflect_dir.normalized());
-      float spec = std::pow((dotProduct > 0 ? dotProduct : 0), 32);
-      Vec3 specular = shape_color * spec;
-
-      light_contribution += (diffuse + specular);
+    const Light& light = lights[i];
+
+    int strata = 1;
+    if (light.isArea()) {
+      strata = std::max(1, (int)std::sqrt((float)area_samples));
     }
+    float weight = 1.0f / float(strata * strata);
+    LightSampler sampler(light, rec.point);
+
+    for (int sy = 0; sy < strata; sy++) {
+      for (int sx = 0; sx < strata; sx++) {
+        float u1 = 0.5f, u2 = 0.5f;
+        if (light.isArea()) {
+          u1 = (sx + jitter(rng)) / strata;
+          u2 = (sy + jitter(rng)) / strata;
+        }
+
+        LightSample sample = sampler.sample(u1, u2);
+        stats.lightSamples++;
+
+        if (N.dot(sample.direction) <= 0.0f) continue;
+        if (sample.intensity.lengthSquared() == 0.0f) continue;
+
+        func(sample, weight);
+      }
+    }
+  }
+}
+
+// A light sample whose shadow ray is still to be traced. If the ray turns
+// out unblocked, contribution reaches the shading point.
+struct ShadowQuery {
+  Ray ray;
+  float max_dist;
+  Vec3 contribution;
+  bool occluded;
+};
+
+// First half of phongShading: appends a shadow query for every light sample
+// that could light the shading point. Keeping this apart from the occlusion
+// test lets batched rendering trace all of a batch's shadow rays together.
+void phongSample(const HitRecord& rec, const Vec3& shape_color, const Ray& ray,
+                 const std::vector<Light>& lights, int area_samples,
+                 std::mt19937& rng, ShadingStats& stats,
+                 std::vector<ShadowQuery>& queries) {
+  Vec3 shadow_origin = shadowRayOrigin(rec);
+  sampleLights(rec, lights, area_samples, rng, stats,
+               [&](const LightSample& sample, float weight) {
+                 stats.shadowRays++;
+                 queries.push_back(
+                     {Ray(shadow_origin, sample.direction),
+                      sample.distance - 1e-3f,
+                      phongBRDF(rec, shape_color, ray, sample.direction,
+                                sample.intensity) *
+                          weight,
+                      false});
+               });
+}
+
+// Second half: ambient plus the light of every query whose shadow ray was
+// not occluded
+Vec3 phongResolve(const Vec3& shape_color, const ShadowQuery* queries,
+                  size_t count, ShadingStats& stats) {
+  Vec3 light_contribution(0, 0, 0);
+  for (size_t i = 0; i < count; i++) {
+    if (queries[i].occluded) {
+      stats.occludedRays++;
+    } else {
+      light_contribution += queries[i].contribution;
+    }
+  }
+  return ambientShading(shape_color) + light_contribution;
+}
+
+Vec3 phongShading(const HitRecord& rec, const Vec3& shape_color, const Ray& ray,
+                  const std::vector<Light>& lights,
+                  const std::vector<Shape>& shapes, int area_samples,
+                  std::mt19937& rng, ShadingStats& stats) {
+  std::vector<ShadowQuery> queries;
+  phongSample(rec, shape_color, ray, lights, area_samples, rng, stats,
+              queries);
+  for (ShadowQuery& query : queries) {
+    query.occluded = isOccluded(query.ray, query.max_dist, shapes);
   }
-  return ambient + light_contribution;
+  return phongResolve(shape_color, queries.data(), queries.size(), stats);
 }
 
 #endif  // SHADING_H
\ No newline at end of file
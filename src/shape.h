@@ -1,6 +1,9 @@
 #ifndef SHAPE_H
 #define SHAPE_H
 
+#include <limits>
+#include <vector>
+
 #include "math_utils.h"
 #include "ray.h"
 
@@ -61,10 +64,12 @@ HitRecord intersectSphere(const Ray& ray, const Sphere& sphere) {
 
     if (dist2 > radius2) return rec;  // No intersection
 
-    // Compute intersection t values
+    // Compute intersection t values. The projection length must keep its
+    // sign, otherwise spheres behind the ray origin count as hits.
     float thc = std::sqrt(radius2 - dist2);
-    float t0 = (proj.length() - thc) / raydir.length();
-    float t1 = (proj.length() + thc) / raydir.length();
+    float tca = -oc.dot(raydir) / raydir.length();
+    float t0 = (tca - thc) / raydir.length();
+    float t1 = (tca + thc) / raydir.length();
 
     // Find the nearest t that is positive
     float t = t0;
@@ -90,6 +95,7 @@ struct Plane {
 
 HitRecord intersectPlane(const Ray& ray, const Plane& plane) {
     HitRecord rec;
+    rec.t = std::numeric_limits<float>::max();
     Vec3 rayDir = ray.getDirection();
     // Distance from ray origin to plane along the normal direction
     // denom for denominator
@@ -153,4 +159,15 @@ struct Shape {
     }
 };
 
+// Any-hit query for shadow rays: true if something lies on the ray closer
+// than maxDist. Unlike the closest-hit search, back faces also block light.
+bool isOccluded(const Ray& ray, float maxDist,
+                const std::vector<Shape>& shapes) {
+    for (const Shape& shape : shapes) {
+        HitRecord rec = shape.intersect(ray);
+        if (rec.t < maxDist) return true;
+    }
+    return false;
+}
+
 #endif  // SHAPE_H
\ No newline at end of file
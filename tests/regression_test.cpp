@@ -0,0 +1,169 @@
+// Renders every canned scene at a small size and checks it against the
+// golden image and frame times stored for it under the data directory:
+//
+//   <data>/golden/<scene>.ppm
+//   <data>/baseline/<scene>.txt
+//
+// Renders and diff images are written to the working directory.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ppmwriter.h"
+#include "regression.h"
+#include "renderer.h"
+#include "scene.h"
+#include "scenes.h"
+
+#define TEST_WIDTH 160
+#define TEST_HEIGHT 90
+#define TEST_SAMPLES_PER_PIXEL 4
+#define TEST_LIGHT_SAMPLES_PER_PIXEL 16
+// Renders per scene when timing; each phase is judged by its median
+#define TEST_TIMING_RUNS 5
+
+// ctest reports a test that exits with this code as skipped
+#define EXIT_SKIPPED 77
+
+// Renders setup runs times. img receives the image, times the median time
+// of each phase.
+bool renderScene(const SceneSetup& setup, int runs, PPMWriter& img,
+                 FrameTimes& times) {
+    Camera cam = setup.makeCamera(TEST_WIDTH, TEST_HEIGHT);
+    Renderer renderer(TEST_WIDTH, TEST_HEIGHT, TEST_SAMPLES_PER_PIXEL,
+                      TEST_LIGHT_SAMPLES_PER_PIXEL);
+
+    std::vector<double> renderTimes, denoiseTimes;
+    for (int run = 0; run < runs; run++) {
+        Scene scene;
+        if (!setup.build(scene)) {
+            std::cerr << "Failed to set up scene " << setup.name << "\n";
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        renderer.render(scene, cam);
+        auto rendered = std::chrono::steady_clock::now();
+        renderer.denoise();
+        auto end = std::chrono::steady_clock::now();
+
+        // Eviction that silently fails would leave the budget unenforced
+        const PagedGeometry* paged = scene.getPagedGeometry();
+        if (paged && paged->getStats().failedAdvice > 0) {
+            std::cerr << "Paged geometry of " << setup.name
+                      << " could not release pages\n";
+            return false;
+        }
+
+        renderTimes.push_back(
+            std::chrono::duration<double>(rendered - start).count());
+        denoiseTimes.push_back(
+            std::chrono::duration<double>(end - rendered).count());
+    }
+
+    times.render = median(renderTimes);
+    times.denoise = median(denoiseTimes);
+    renderer.writeImage(img);
+    return true;
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " --data <dir> [--images] [--timing] [--scene <name>]"
+                 " [--max-slowdown <fraction>] [--update]\n"
+              << "  --data    directory holding golden/ and baseline/\n"
+              << "  --images  only compare against the golden images\n"
+              << "  --timing  only compare against the frame time baselines\n"
+              << "  --scene   only test this scene\n"
+              << "  --max-slowdown  allowed time increase per phase,\n"
+              << "                  default " << BASELINE_MAX_SLOWDOWN << "\n"
+              << "  --update  store the renders and frame times as the new\n"
+              << "            golden images and baselines instead\n";
+}
+
+int main(int argc, char** argv) {
+    std::string dataDir, sceneName;
+    double maxSlowdown = BASELINE_MAX_SLOWDOWN;
+    bool images = false, timing = false, update = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--data") == 0 && hasValue) {
+            dataDir = argv[++i];
+        } else if (std::strcmp(argv[i], "--scene") == 0 && hasValue) {
+            sceneName = argv[++i];
+        } else if (std::strcmp(argv[i], "--max-slowdown") == 0 && hasValue) {
+            maxSlowdown = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--images") == 0) {
+            images = true;
+        } else if (std::strcmp(argv[i], "--timing") == 0) {
+            timing = true;
+        } else if (std::strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (dataDir.empty() || (!sceneName.empty() && !findScene(sceneName)) ||
+        maxSlowdown < 0.0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+    if (!images && !timing) images = timing = true;
+
+    bool pass = true;
+    bool otherBuild = false;
+    for (const SceneSetup& setup : cannedScenes()) {
+        if (!sceneName.empty() && sceneName != setup.name) continue;
+        std::cout << "[" << setup.name << "]\n";
+
+        PPMWriter img(1, 1);
+        FrameTimes times;
+        if (!renderScene(setup, timing ? TEST_TIMING_RUNS : 1, img, times)) {
+            pass = false;
+            continue;
+        }
+
+        std::string name = setup.name;
+        std::string goldenFile = dataDir + "/golden/" + name + ".ppm";
+        std::string baselineFile = dataDir + "/baseline/" + name + ".txt";
+        if (!img.write(name + ".ppm")) {
+            std::cerr << "Failed to write " << name << ".ppm\n";
+            pass = false;
+        }
+
+        if (update) {
+            if (images && !img.write(goldenFile)) {
+                std::cerr << "Failed to write " << goldenFile << "\n";
+                pass = false;
+            }
+            if (timing && !Baseline::current(times).write(baselineFile)) {
+                std::cerr << "Failed to write " << baselineFile << "\n";
+                pass = false;
+            }
+            continue;
+        }
+
+        if (images) {
+            pass = checkGolden(img, goldenFile, name + "_diff.ppm") && pass;
+        }
+        if (timing) {
+            BaselineResult result =
+                checkBaseline(times, baselineFile, maxSlowdown);
+            if (result == BASELINE_OTHER_BUILD) {
+                otherBuild = true;
+            } else if (result != BASELINE_PASS) {
+                pass = false;
+            }
+        }
+    }
+
+    if (!pass) return 1;
+    // Frame times from another machine or build prove nothing either way
+    if (otherBuild) return EXIT_SKIPPED;
+    return 0;
+}